@@ -72,11 +72,15 @@ from .utils import (FixedOffset, NotifyingList,
 
 def initLog():
     """Initialize exiv2 log system
+
+    Not to be called while images are read or written by other threads.
     """
     libexiv2python._initLog()
 
 def setLogLevel(level):
     """Set exiv2 log level
+
+    Not to be called while images are read or written by other threads.
     """
     libexiv2python._setLogLevel(level)
 
@@ -33,7 +33,6 @@ from . import libexiv2python
 
 from .utils import (is_fraction, make_fraction, fraction_to_string,
                           NotifyingList, ListenerInterface,
-                          undefined_to_string, string_to_undefined,
                           DateTimeFormatter)
 
 import time
@@ -67,11 +66,12 @@ class ExifTag(ListenerInterface):
     - Ascii: :class:`datetime.datetime`, :class:`datetime.date`, string
     - Byte, SByte: bytes
     - Comment: string
+    - Float, Double: [list of] float
     - Long, SLong: [list of] int
     - Short, SShort: [list of] int
     - Rational, SRational: [list of] :class:`fractions.Fraction` if available
       (Python ≥ 2.6) or :class:`pyexiv2.utils.Rational`      
-    - Undefined: string
+    - Undefined: bytes
     """
     # According to the EXIF specification, the only accepted format for an Ascii
     # value representing a datetime is '%Y:%m:%d %H:%M:%S', but it seems that
@@ -82,6 +82,12 @@ class ExifTag(ListenerInterface):
 
     _date_formats = ('%Y:%m:%d',)
 
+    # The data of the tags of these types is read and set natively as bytes.
+    # Their raw value (the space-separated decimal values of the bytes) is
+    # only computed when accessed.
+    _bytes_types = ('Byte', 'SByte', 'Undefined')
+    _raw_value_cookie = False
+
     def __init__(self, key, value=None, _tag=None):
         """ The tag can be initialized with an optional value which expected
         type depends on the EXIF type of the tag.
@@ -114,16 +120,58 @@ class ExifTag(ListenerInterface):
         tag = ExifTag(_tag._getKey(), _tag=_tag)
         # Do not set the raw_value property, as it would call _tag._setRawValue
         # (see https://bugs.launchpad.net/pyexiv2/+bug/582445).
-        tag._raw_value = _tag._getRawValue()
+        if _tag._getType() in ExifTag._bytes_types:
+            tag._raw_value_cookie = True
+        else:
+            tag._raw_value = _tag._getRawValue()
         tag._value_cookie = True
         return tag
 
+    @staticmethod
+    def _from_item(item, _image):
+        """Build a tag from a (key, type, raw value) item of a metadata
+        snapshot (see ImageMetadata.prefetch), where the raw value of the
+        byte types is replaced by their data.
+
+        The underlying libexiv2python._ExifTag is only fetched from the image
+        when it is needed, e.g. to modify the tag.
+        """
+        tag = ExifTag.__new__(ExifTag)
+        tag.__tag = None
+        tag._item = (item[0], item[1], _image)
+        if isinstance(item[2], bytes):
+            tag._raw_value = None
+            tag._raw_value_cookie = True
+            tag._value = item[2]
+            tag._value_cookie = False
+        else:
+            tag._raw_value = item[2]
+            tag._value = None
+            tag._value_cookie = True
+        return tag
+
+    def _get_tag(self):
+        if self.__tag is None:
+            # Built from a snapshot item, bind it to the image now.
+            key, type_, image = self._item
+            self.__tag = image._getExifTag(key)
+            self._item = None
+        return self.__tag
+
+    def _set_tag(self, _tag):
+        self.__tag = _tag
+        self._item = None
+
+    _tag = property(fget=_get_tag, fset=_set_tag)
+
     @property
     def key(self):
         """The key of the tag in the dotted form
         ``familyName.groupName.tagName`` where ``familyName`` = ``exif``.
 
         """
+        if self._item is not None:
+            return self._item[0]
         return self._tag._getKey()
 
     @property
@@ -132,6 +180,8 @@ class ExifTag(ListenerInterface):
         SShort, Long, SLong, Rational, SRational, Undefined).
 
         """
+        if self._item is not None:
+            return self._item[1]
         return self._tag._getType()
 
     @property
@@ -170,11 +220,15 @@ class ExifTag(ListenerInterface):
         return self._tag._getSectionDescription()
 
     def _get_raw_value(self):
+        if self._raw_value_cookie:
+            self._raw_value = self._tag._getRawValue()
+            self._raw_value_cookie = False
         return self._raw_value
 
     def _set_raw_value(self, value):
         self._tag._setRawValue(value)
         self._raw_value = value
+        self._raw_value_cookie = False
         self._value_cookie = True
 
     raw_value = property(fget=_get_raw_value, fset=_set_raw_value,
@@ -184,10 +238,23 @@ class ExifTag(ListenerInterface):
         """Lazy computation of the value from the raw value.
 
         """
+        if self._item is None:
+            # Most types are read natively, without parsing the raw value
+            typed = self._tag._getTypedValue()
+            if typed is not None:
+                if isinstance(typed, list):
+                    values = [self._convert_typed_to_python(v) for v in typed]
+                    self._value = NotifyingList(values)
+                    self._value.register_listener(self)
+                else:
+                    self._value = self._convert_typed_to_python(typed)
+                self._value_cookie = False
+                return
+
         if self.type in ('Short', 'SShort', 'Long', 'SLong', 
                          'Rational', 'SRational', 'Double', 'Float'):
             # May contain multiple values
-            values = self._raw_value.split()
+            values = self.raw_value.split()
             if len(values) > 1:
                 # Make values a notifying list
                 values = [self._convert_to_python(v) for v in values]
@@ -196,7 +263,7 @@ class ExifTag(ListenerInterface):
                 self._value_cookie = False
                 return
 
-        self._value = self._convert_to_python(self._raw_value)
+        self._value = self._convert_to_python(self.raw_value)
         self._value_cookie = False
 
     def _get_value(self):
@@ -206,6 +273,24 @@ class ExifTag(ListenerInterface):
 
     def _set_value(self, value):
         if isinstance(value, (list, tuple)):
+            items = self._convert_to_items(value)
+        else:
+            items = self._convert_to_items([value])
+
+        if items is not None:
+            # Most types are set natively, without formatting a raw value
+            self._tag._setTypedValue(items)
+            if self.type in self._bytes_types:
+                # The data of the tag is its value
+                value = bytes(items[0])
+                self._raw_value = None
+                self._raw_value_cookie = True
+            else:
+                self._raw_value = self._tag._getRawValue()
+                self._raw_value_cookie = False
+            self._value_cookie = True
+
+        elif isinstance(value, (list, tuple)):
             raw_values = [self._convert_to_string(v) for v in value]
             self.raw_value = ' '.join(raw_values)
 
@@ -300,10 +385,16 @@ class ExifTag(ListenerInterface):
             # where relevant.
             return value
 
-        elif self.type in ('Byte', 'SByte'):
-            if isinstance(value, bytes):
-                return value.decode('utf-8')
-            return value
+        elif self.type in self._bytes_types:
+            if not isinstance(value, str):
+                # Bytes-like data
+                return bytes(value)
+
+            # The raw value holds the decimal values of the bytes
+            try:
+                return self._bytes_from_ints([int(v) for v in value.split()])
+            except ValueError:
+                raise ExifValueError(value, self.type)
 
         elif self.type == 'Comment':
             if isinstance(value, str):
@@ -356,14 +447,38 @@ class ExifTag(ListenerInterface):
                 raise ExifValueError(value, self.type)
 
 
-        elif self.type == 'Undefined':
-            # There is currently no charset conversion.
-            # TODO: guess the encoding and decode accordingly into unicode
-            # where relevant.
-            return undefined_to_string(value)
-
         raise ExifValueError(value, self.type)
 
+    def _convert_typed_to_python(self, value):
+        """
+        Convert one value read natively (see _ExifTag._getTypedValue) to its
+        corresponding python type.
+
+        :param value: an int, a (numerator, denominator) tuple for a rational,
+                      the fields of a date or datetime for an Ascii value, or
+                      a string
+
+        :return: the value converted to its corresponding python type
+
+        :raise ExifValueError: if the conversion fails
+        """
+        if not isinstance(value, tuple):
+            return value
+
+        if len(value) == 2:
+            try:
+                return make_fraction(*value)
+            except ZeroDivisionError:
+                raise ExifValueError(self.raw_value, self.type)
+
+        try:
+            if len(value) == 3:
+                return datetime.date(*value)
+            return datetime.datetime(*value)
+        except ValueError:
+            # Not a valid date, let the generic conversion decide
+            return self._convert_to_python(self.raw_value)
+
     def _convert_to_string(self, value):
         """
         Convert one value to its corresponding string representation, suitable
@@ -391,18 +506,17 @@ class ExifTag(ListenerInterface):
             else:
                 return value
 
-        elif self.type in ('Byte', 'SByte'):
-            if isinstance(value, str):
-                try:
-                    return value.encode('utf-8')
-                except UnicodeEncodeError:
-                    raise ExifValueError(value, self.type)
-
-            elif isinstance(value, bytes):
-                return value
-
+        elif self.type in self._bytes_types:
+            # The same values as set natively, as the decimal values of the
+            # bytes (signed for SByte)
+            if isinstance(value, (list, tuple)):
+                data = self._convert_to_items(value)[0]
             else:
-                raise ExifValueError(value, self.type)
+                data = self._convert_to_items([value])[0]
+            if self.type == 'SByte':
+                return ' '.join(str(b - 256 if b > 127 else b)
+                                for b in bytes(data))
+            return ' '.join(str(b) for b in bytes(data))
 
         elif self.type == 'Comment':
             return self._convert_to_bytes(value)
@@ -449,20 +563,110 @@ class ExifTag(ListenerInterface):
             else:
                 raise ExifValueError(value, self.type)
 
-        elif self.type == 'Undefined':
-            if isinstance(value, str):
+        raise ExifValueError(value, self.type)
+
+    def _convert_to_items(self, values):
+        """
+        Convert values to the items of the corresponding libexiv2 value, to
+        be set natively (see _ExifTag._setTypedValue).
+
+        :param values: the values to be converted
+        :type values: list
+
+        :return: the items of the value, or None if the values have to be
+                 set from their string representation
+        :rtype: list
+
+        :raise ExifValueError: if the conversion fails
+        """
+        if self.type in ('Short', 'Long', 'SShort', 'SLong'):
+            unsigned = self.type in ('Short', 'Long')
+            for value in values:
+                if not isinstance(value, int) or (unsigned and value < 0):
+                    raise ExifValueError(value, self.type)
+            return list(values)
+
+        elif self.type in ('Rational', 'SRational'):
+            items = []
+            for value in values:
+                if not is_fraction(value) or \
+                        (self.type == 'Rational' and value.numerator < 0):
+                    raise ExifValueError(value, self.type)
+                items.append((value.numerator, value.denominator))
+            return items
+
+        elif self.type in ('Float', 'Double'):
+            items = []
+            for value in values:
+                if not isinstance(value, (int, float)):
+                    raise ExifValueError(value, self.type)
+                items.append(float(value))
+            return items
+
+        elif self.type in self._bytes_types and len(values) != 1:
+            # A list of the values of the bytes
+            return [self._bytes_from_ints(values)]
+
+        elif len(values) != 1:
+            return None
+
+        value = values[0]
+        if self.type == 'Ascii':
+            if isinstance(value, datetime.datetime):
+                return [(value.year, value.month, value.day,
+                         value.hour, value.minute, value.second)]
+
+            elif isinstance(value, datetime.date):
+                if self.key == 'Exif.GPSInfo.GPSDateStamp':
+                    # Special case
+                    return [(value.year, value.month, value.day)]
+
+                else:
+                    return [(value.year, value.month, value.day, 0, 0, 0)]
+
+            elif isinstance(value, str):
+                return [value]
+
+        elif self.type in self._bytes_types:
+            if isinstance(value, int):
+                return [self._bytes_from_ints(values)]
+
+            elif isinstance(value, str):
+                # Undefined strings have always been converted character by
+                # character, Byte strings are encoded in UTF-8.
+                encoding = 'latin-1' if self.type == 'Undefined' else 'utf-8'
                 try:
-                    return string_to_undefined(value)
+                    return [value.encode(encoding)]
                 except UnicodeEncodeError:
                     raise ExifValueError(value, self.type)
 
-            elif isinstance(value, bytes):
-                return string_to_undefined(value)
-
-            else:
+            try:
+                memoryview(value)
+            except TypeError:
                 raise ExifValueError(value, self.type)
+            else:
+                # Any bytes-like object, set without copy
+                return [value]
 
-        raise ExifValueError(value, self.type)
+        return None
+
+    def _bytes_from_ints(self, values):
+        """
+        Pack the values of a Byte, SByte or Undefined tag into bytes.
+
+        :param values: the values of the bytes, signed for SByte
+        :type values: list of int
+
+        :return: the data of the tag
+        :rtype: bytes
+
+        :raise ExifValueError: if a value is out of the range of the type
+        """
+        lower, upper = (-128, 127) if self.type == 'SByte' else (0, 255)
+        for value in values:
+            if not isinstance(value, int) or not lower <= value <= upper:
+                raise ExifValueError(value, self.type)
+        return bytes(value & 0xff for value in values)
 
     def _convert_to_bytes(self, value):
         if value is None:
@@ -499,14 +703,15 @@ class ExifTag(ListenerInterface):
         :rtype: string
         """
         left = '%s [%s]' % (self.key, self.type)
-        if self._raw_value is None:
+        raw_value = self.raw_value
+        if raw_value is None:
             right = '(No value)'
 
-        elif self.type == 'Undefined' and len(self._raw_value) > 100:
+        elif self.type == 'Undefined' and len(raw_value) > 100:
             right = '(Binary value suppressed)'
 
         else:
-             right = self._raw_value
+             right = raw_value
 
         return '<%s = %s>' % (left, right)
 
@@ -584,14 +789,16 @@ class ExifThumbnail(object):
         self._update_exif_tags_cache()
 
     def _get_data(self):
-        buf_ = self._metadata._image._getExifThumbnailData()
-        return buf_
+        return self._metadata._image._getExifThumbnailData()
 
     def _set_data(self, data):
+        if isinstance(data, str):
+            data = data.encode('utf-8')
         self._metadata._image._setExifThumbnailFromData(data)
         self._update_exif_tags_cache()
 
     data = property(fget=_get_data, fset=_set_data,
-                    doc='The raw thumbnail data. Setting it is restricted to ' +
-                        'a buffer in the JPEG format.')
+                    doc='The raw thumbnail data, as bytes. Setting it is ' +
+                        'restricted to a buffer in the JPEG format (any ' +
+                        'object supporting the buffer protocol).')
 
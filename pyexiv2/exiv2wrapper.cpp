@@ -29,8 +29,36 @@
 
 #include "exiv2wrapper.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace py = pybind11;
 
@@ -56,14 +84,20 @@ const char *EXCEPTION_HINT = "Caught Exiv2 exception: ";
 #ifdef HAVE_CLASS_ERROR_CODE
 #define CHECK_METADATA_READ \
     if (!_dataRead) throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, "metadata not read");
+#define CHECK_FAMILY_READ(read, family) \
+    if (!(read)) throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, family " metadata not read");
 #else
 #ifdef HAVE_EXIV2_ERROR_CODE
 #define CHECK_METADATA_READ \
     if (!_dataRead) throw Exiv2::Error(Exiv2::kerErrorMessage, "metadata not read");
+#define CHECK_FAMILY_READ(read, family) \
+    if (!(read)) throw Exiv2::Error(Exiv2::kerErrorMessage, family " metadata not read");
 #else
 #define HAVE_OLD_ERROR_CODE
 #define CHECK_METADATA_READ \
     if (!_dataRead) throw Exiv2::Error(METADATA_NOT_READ);
+#define CHECK_FAMILY_READ(read, family) \
+    if (!(read)) throw Exiv2::Error(METADATA_NOT_READ);
 #endif
 #endif
 
@@ -74,201 +108,2758 @@ const char *EXCEPTION_HINT = "Caught Exiv2 exception: ";
 namespace exiv2wrapper
 {
 
-void Image::_instantiate_image()
+// Return the size in bytes of a buffer, which must be C-contiguous to be
+// handed over to Exiv2 as a plain array of bytes.
+static py::ssize_t contiguousSize(const py::buffer_info& info)
 {
-    _exifThumbnail = 0;
+    py::ssize_t stride = info.itemsize;
+    for (py::ssize_t i = info.ndim - 1; i >= 0; --i)
+    {
+        if (info.shape[i] > 1 && info.strides[i] != stride)
+        {
+            throw py::buffer_error("Image buffer must be C-contiguous");
+        }
+        stride *= info.shape[i];
+    }
+    return info.size * info.itemsize;
+}
 
-    // If an exception is thrown, it has to be done outside of the
-    // Py_{BEGIN,END}_ALLOW_THREADS block.
-#ifdef HAVE_CLASS_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::ErrorCode::kerSuccess);
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::kerSuccess);
-#else
-    Exiv2::Error error(0);
-#endif
-#endif
+// Run a function with the GIL released, to let the other python threads run
+// meanwhile. The function must not touch any python object, and the metadata
+// it uses must be guarded by the lock of its image (see ImageLock), which the
+// GIL no longer guards. An exception it throws is rethrown once the GIL is
+// re-acquired.
+template <typename Function>
+static void withoutGil(Function function)
+{
+    std::exception_ptr error;
 
-    // Release the GIL to allow other python threads to run
-    // while opening the file.
     Py_BEGIN_ALLOW_THREADS
 
     try
     {
-        if (_data != 0)
-        {
-            _image = Exiv2::ImageFactory::open(_data, _size);
-        }
-        else
+        function();
+    }
+
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+// Hold the lock of an image (or of a detached tag) for the scope of a method.
+// The GIL is only released if the lock has to be waited for, so that the
+// thread holding it may re-acquire the GIL meanwhile. A reference on the
+// state is kept, as a tag may be attached to another image in the meantime.
+class ImageLock
+{
+public:
+    explicit ImageLock(const ImageStatePtr& state):
+        _state(state), _lock(_state->mutex, std::try_to_lock)
+    {
+        if (!_lock.owns_lock())
         {
-            _image = Exiv2::ImageFactory::open(_filename);
+            py::gil_scoped_release release;
+            _lock.lock();
         }
     }
 
-    catch (Exiv2::Error& err) 
+private:
+    ImageStatePtr _state;
+    std::unique_lock<std::recursive_mutex> _lock;
+};
+
+// Lock the state of a tag, which is replaced by the one of its image when
+// the tag is attached to an image (see setParentImage).
+static ImageLock lockTag(const ImageStatePtr& state)
+{
+    for (;;)
     {
-        //std::cout << " Caught Exiv2 exception '" << err.code() << "'\n";
-        error = err;
+        ImageStatePtr current = std::atomic_load(&state);
+        ImageLock lock(current);
+        if (std::atomic_load(&state) == current)
+        {
+            return lock;
+        }
     }
-    // Re-acquire the GIL
-    Py_END_ALLOW_THREADS
+}
 
-    if (error.code() == Exiv2::ErrorCode::kerSuccess)
+// Lock handed to the XMP toolkit (see Exiv2::XmpParser::initialize). Exiv2
+// only takes it around the (un)registrations of namespaces in the toolkit
+// (Exiv2::XmpParser::registerNs and unregisterNs), it does not serialise the
+// other calls, which is why the namespace registry has its own guard below.
+static std::mutex xmpToolkitMutex;
+
+static void xmpLockFct(void* pLockData, bool lockUnlock)
+{
+    std::mutex* mutex = static_cast<std::mutex*>(pLockData);
+    if (lockUnlock)
     {
-        assert(_image.get() != 0);
-        _dataRead = false;
+        mutex->lock();
     }
     else
     {
-        throw error;
+        mutex->unlock();
     }
 }
 
-// Base constructor
-Image::Image(const std::string& filename)
+// Initialise the XMP toolkit with its lock. This is a no-op if it is already
+// initialised, so it must be done before any other use of the toolkit, with
+// the GIL held.
+static bool initialiseXmpToolkit()
 {
-    _filename = filename;
-    _data = 0;
-    _instantiate_image();
+    return Exiv2::XmpParser::initialize(xmpLockFct, &xmpToolkitMutex);
 }
 
-// From buffer constructor
-Image::Image(const std::string& buffer, unsigned long size)
+// Guard of the registry of XMP namespaces: it is shared by the readers and
+// writers of XMP data, and exclusively held to (un)register a namespace.
+// It must always be waited on with the GIL released, shared or exclusive:
+// a reader waiting for it with the GIL held would deadlock with a writer
+// holding it and waiting for the GIL.
+static std::shared_mutex xmpNsMutex;
+
+// Take the exclusive lock on the namespace registry, waiting for the pending
+// XMP reads and writes without holding the GIL.
+static std::unique_lock<std::shared_mutex> lockXmpNamespaces()
+{
+    py::gil_scoped_release release;
+    return std::unique_lock<std::shared_mutex>(xmpNsMutex);
+}
+
+// Process-wide cache of the static descriptors of the tags, which are
+// immutable for a given key. The descriptors are never freed, so that the tags
+// can keep a pointer to theirs.
+template <typename Id, typename Info>
+class DescriptorCache
 {
-    // Deep copy of the data buffer
-    _data = new Exiv2::byte[size];
-    for (unsigned long i = 0; i < size; ++i)
+public:
+    template <typename Make>
+    Info* get(const Id& id, Make make)
     {
-        _data[i] = buffer[i];
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto found = _infos.find(id);
+            if (found != _infos.end())
+            {
+                return found->second.get();
+            }
+        }
+        // The descriptor is built without holding the lock: if another thread
+        // inserted it in the meantime, emplace keeps the first one.
+        std::unique_ptr<Info> info = make();
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        return _infos.emplace(id, std::move(info)).first->second.get();
     }
 
-    _size = size;
-    _instantiate_image();
+private:
+    std::shared_mutex _mutex;
+    std::unordered_map<Id, std::unique_ptr<Info>> _infos;
+};
+
+// The label and description of the tags are only looked up when asked for,
+// which is seldom.
+struct ExifTagInfo
+{
+    std::string defaultType;
+    std::string name;
+    std::string sectionName;
+    std::string sectionDescription;
+    std::once_flag labelFlag;
+    std::string label;
+    std::once_flag descriptionFlag;
+    std::string description;
+};
+
+struct IptcTagInfo
+{
+    std::string type;
+    std::string name;
+    std::string photoshopName;
+    bool repeatable;
+    std::string recordName;
+    std::string recordDescription;
+    std::once_flag titleFlag;
+    std::string title;
+    std::once_flag descriptionFlag;
+    std::string description;
+};
+
+struct XmpTagInfo
+{
+    std::string defaultExiv2Type;
+    std::string name;
+    std::string type;
+    std::once_flag titleFlag;
+    std::string title;
+    std::once_flag descriptionFlag;
+    std::string description;
+};
+
+// EXIF descriptors are keyed by (ifd, tag).
+static DescriptorCache<uint64_t, ExifTagInfo> exifTagInfos;
+
+static ExifTagInfo* exifTagInfo(Exiv2::IfdId ifd, uint16_t tag,
+                                const std::string& key)
+{
+    uint64_t id = (static_cast<uint64_t>(ifd) << 16) | tag;
+    return exifTagInfos.get(id, [&key]()
+    {
+        Exiv2::ExifKey exifKey(key);
+        std::unique_ptr<ExifTagInfo> info(new ExifTagInfo());
+        info->defaultType = Exiv2::TypeInfo::typeName(exifKey.defaultTypeId());
+        info->name = exifKey.tagName();
+        info->sectionName = Exiv2::ExifTags::sectionName(exifKey);
+        // The section description is not exposed in the API any longer
+        // (see http://dev.exiv2.org/issues/744). For want of anything better,
+        // fall back on the section’s name.
+        info->sectionDescription = info->sectionName;
+        return info;
+    });
 }
 
-// Copy constructor
-Image::Image(const Image& image)
+// IPTC descriptors are keyed by (record, dataset).
+static DescriptorCache<uint32_t, IptcTagInfo> iptcTagInfos;
+
+static IptcTagInfo* iptcTagInfo(uint16_t tag, uint16_t record)
 {
-    _filename = image._filename;
-    _instantiate_image();
+    uint32_t id = (static_cast<uint32_t>(record) << 16) | tag;
+    return iptcTagInfos.get(id, [tag, record]()
+    {
+        std::unique_ptr<IptcTagInfo> info(new IptcTagInfo());
+        info->type = Exiv2::TypeInfo::typeName(
+            Exiv2::IptcDataSets::dataSetType(tag, record));
+        info->name = Exiv2::IptcDataSets::dataSetName(tag, record);
+        // What is the photoshop name anyway? Where is it used?
+        info->photoshopName = Exiv2::IptcDataSets::dataSetPsName(tag, record);
+        info->repeatable = Exiv2::IptcDataSets::dataSetRepeatable(tag, record);
+        info->recordName = Exiv2::IptcDataSets::recordName(record);
+        info->recordDescription = Exiv2::IptcDataSets::recordDesc(record);
+        return info;
+    });
 }
 
-Image::~Image()
+// XMP descriptors are keyed by namespace and key, as a prefix may be
+// registered again for another namespace. The descriptor of a path only
+// depends on its innermost property, not on the indices of its array items:
+// these are dropped from the key, so that the number of descriptors is
+// bounded by the schemas rather than by the data read.
+static DescriptorCache<std::string, XmpTagInfo> xmpTagInfos;
+
+static std::string xmpDescriptorKey(const Exiv2::XmpKey& key)
 {
-    if (_data != 0)
+    const std::string path = key.key();
+    std::string id = key.ns() + ' ';
+    id.reserve(id.size() + path.size());
+    bool index = false;
+    for (char c : path)
     {
-        delete[] _data;
+        if (index && c != ']')
+        {
+            continue;
+        }
+        index = (c == '[');
+        id += c;
     }
-    if (_exifThumbnail != 0)
+    return id;
+}
+
+static XmpTagInfo* xmpTagInfo(const Exiv2::XmpKey& key)
+{
+    return xmpTagInfos.get(xmpDescriptorKey(key), [&key]()
     {
-        delete _exifThumbnail;
+        std::unique_ptr<XmpTagInfo> info(new XmpTagInfo());
+        info->defaultExiv2Type = Exiv2::TypeInfo::typeName(
+            Exiv2::XmpProperties::propertyType(key));
+        const Exiv2::XmpPropertyInfo* property =
+            Exiv2::XmpProperties::propertyInfo(key);
+        if (property != 0)
+        {
+            info->name = property->name_;
+            info->type = property->xmpValueType_;
+        }
+        return info;
+    });
+}
+
+// Type name of an EXIF datum, as reported by ExifTag::getType(): where
+// available, the type is extracted from the metadata, it is more reliable
+// than static type information. The exception is for user comments, for
+// which we’d rather keep the 'Comment' type instead of 'Undefined'.
+static const char* exifTypeName(const Exiv2::Exifdatum& datum,
+                                const ExifTagInfo* info)
+{
+    if (info->defaultType != "Comment")
+    {
+        const char* typeName = datum.typeName();
+        if (typeName != 0)
+        {
+            return typeName;
+        }
     }
+    return info->defaultType.c_str();
 }
 
-void Image::readMetadata()
+static py::list xmpArrayValue(const Exiv2::Value& value)
 {
-    // If an exception is thrown, it has to be done outside of the
-    // Py_{BEGIN,END}_ALLOW_THREADS block.
-#ifdef HAVE_CLASS_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::ErrorCode::kerSuccess);
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::kerSuccess);
+#ifdef HAVE_OLD_ERROR_CODE
+    std::vector<std::string> values =
+        dynamic_cast<const Exiv2::XmpArrayValue*>(&value)->value_;
+    py::list rvalue;
+    for(std::vector<std::string>::const_iterator i = values.begin();
+        i != values.end(); ++i)
+    {
+        rvalue.append(*i);
+    }
+    return rvalue;
 #else
-    Exiv2::Error error(0);
-#endif
+    // We can't use &_datum->value())->value_ because value_ is private in
+    // this context (change in libexiv2 0.27)
+    const Exiv2::XmpArrayValue* xav = 
+            dynamic_cast<const Exiv2::XmpArrayValue*>(&value);
+    py::list rvalue;
+    for(size_t i = 0; i < xav->count(); ++i)
+    {
+        rvalue.append(xav->toString(i));
+    }
+    return rvalue;
 #endif
+}
 
-    // Release the GIL to allow other python threads to run
-    // while reading metadata.
-    Py_BEGIN_ALLOW_THREADS
+static py::dict xmpLangAltValue(const Exiv2::Value& value)
+{
+    const Exiv2::LangAltValue::ValueType& values =
+        dynamic_cast<const Exiv2::LangAltValue*>(&value)->value_;
+    py::dict rvalue;
+    for (Exiv2::LangAltValue::ValueType::const_iterator i = values.begin();
+         i != values.end(); ++i)
+    {
+        rvalue[i->first.c_str()] = i->second;
+    }
+    return rvalue;
+}
 
-    try
+// Raw value of an XMP datum, as returned by the XmpTag getter matching its
+// Exiv2 type (None for the types not handled).
+static py::object xmpRawValue(const Exiv2::Value& value)
+{
+    switch (value.typeId())
     {
-        _image->readMetadata();
-        _exifData = &_image->exifData();
-        _iptcData = &_image->iptcData();
-        _xmpData = &_image->xmpData();
-        _dataRead = true;
+        case Exiv2::xmpText:
+            return py::str(
+                dynamic_cast<const Exiv2::XmpTextValue*>(&value)->value_);
+        case Exiv2::xmpAlt:
+        case Exiv2::xmpBag:
+        case Exiv2::xmpSeq:
+            return xmpArrayValue(value);
+        case Exiv2::langAlt:
+            return xmpLangAltValue(value);
+        default:
+            return py::none();
+    }
+}
+
+// Items of an Exiv2::ValueType<T>, converted one by one: a single item is
+// returned as is, several items as a list (None if there is no item).
+template <typename T, typename Convert>
+static py::object valueItems(const Exiv2::Value& value, Convert convert)
+{
+    const Exiv2::ValueType<T>* typed =
+        dynamic_cast<const Exiv2::ValueType<T>*>(&value);
+    if (typed == 0 || typed->value_.empty())
+    {
+        return py::none();
+    }
+    if (typed->value_.size() == 1)
+    {
+        return convert(typed->value_.front());
+    }
+    py::list items;
+    for (const T& item : typed->value_)
+    {
+        items.append(convert(item));
+    }
+    return items;
+}
+
+static bool parseDigits(const std::string& value, size_t pos, size_t count,
+                        int& result)
+{
+    result = 0;
+    for (size_t i = pos; i < pos + count; ++i)
+    {
+        if (value[i] < '0' || value[i] > '9')
+        {
+            return false;
+        }
+        result = result * 10 + (value[i] - '0');
+    }
+    return true;
+}
+
+// Typed value of an Ascii EXIF value: the fields of a datetime or date in
+// the EXIF format ('%Y:%m:%d %H:%M:%S' or '%Y:%m:%d') as a tuple, the string
+// itself when it cannot be a date in any of the formats accepted by the
+// Python layer (they all start with a 4-digit year followed by ':' or '-'),
+// None when the string has to be parsed there.
+static py::object exifAsciiValue(const Exiv2::Value& value)
+{
+    std::string text = value.toString();
+    int year, month, day, hours, minutes, seconds;
+    if (text.size() < 5 || !parseDigits(text, 0, 4, year) ||
+        (text[4] != ':' && text[4] != '-'))
+    {
+        return py::str(text);
+    }
+    if ((text.size() == 10 || text.size() == 19) &&
+        text[4] == ':' && text[7] == ':' &&
+        parseDigits(text, 5, 2, month) && parseDigits(text, 8, 2, day))
+    {
+        if (text.size() == 10)
+        {
+            return py::make_tuple(year, month, day);
+        }
+        if (text[10] == ' ' && text[13] == ':' && text[16] == ':' &&
+            parseDigits(text, 11, 2, hours) &&
+            parseDigits(text, 14, 2, minutes) &&
+            parseDigits(text, 17, 2, seconds))
+        {
+            return py::make_tuple(year, month, day, hours, minutes, seconds);
+        }
+    }
+    return py::none();
+}
+
+// Typed value of an EXIF datum, read directly from its Exiv2::Value: int for
+// the integer types, (numerator, denominator) for the rationals and the
+// fields of a datetime for an Ascii date (see exifAsciiValue), as a list if
+// the datum has several components. None for the other types, whose value
+// is converted from its string representation by the Python layer.
+static py::object exifTypedValue(const Exiv2::Exifdatum& datum)
+{
+    if (datum.count() == 0)
+    {
+        return py::none();
+    }
+    const Exiv2::Value& value = datum.value();
+    switch (value.typeId())
+    {
+        case Exiv2::unsignedShort:
+            return valueItems<uint16_t>(value,
+                [](uint16_t item) { return py::int_(item); });
+        case Exiv2::signedShort:
+            return valueItems<int16_t>(value,
+                [](int16_t item) { return py::int_(item); });
+        case Exiv2::unsignedLong:
+            return valueItems<uint32_t>(value,
+                [](uint32_t item) { return py::int_(item); });
+        case Exiv2::signedLong:
+            return valueItems<int32_t>(value,
+                [](int32_t item) { return py::int_(item); });
+        case Exiv2::unsignedRational:
+            return valueItems<Exiv2::URational>(value,
+                [](const Exiv2::URational& item)
+                { return py::make_tuple(item.first, item.second); });
+        case Exiv2::signedRational:
+            return valueItems<Exiv2::Rational>(value,
+                [](const Exiv2::Rational& item)
+                { return py::make_tuple(item.first, item.second); });
+        case Exiv2::asciiString:
+            return exifAsciiValue(value);
+        default:
+            return py::none();
+    }
+}
+
+// Whether the values of an EXIF type are exposed as bytes (Byte, SByte and
+// Undefined).
+static bool isExifBytesType(const char* typeName)
+{
+    Exiv2::TypeId type = Exiv2::TypeInfo::typeId(typeName);
+    return type == Exiv2::unsignedByte || type == Exiv2::signedByte ||
+           type == Exiv2::undefined;
+}
+
+// Data of an EXIF datum as bytes, copied directly from its Exiv2 value
+// instead of going through its string representation (space-separated
+// decimal values for the byte types).
+static py::bytes exifBytesValue(const Exiv2::Exifdatum& datum)
+{
+    py::bytes data(static_cast<const char*>(0), datum.size());
+    datum.copy(reinterpret_cast<Exiv2::byte*>(PyBytes_AS_STRING(data.ptr())),
+               Exiv2::invalidByteOrder);
+    return data;
+}
+
+// Typed value of an IPTC datum: int for a Short, the fields of a date, the
+// fields of a time with the sign and absolute value of its offset. None for
+// the other types, whose value is converted from its string representation
+// by the Python layer.
+static py::object iptcTypedValue(const Exiv2::Iptcdatum& datum)
+{
+    if (datum.count() == 0)
+    {
+        return py::none();
+    }
+    const Exiv2::Value& value = datum.value();
+    switch (value.typeId())
+    {
+        case Exiv2::unsignedShort:
+        {
+            const Exiv2::UShortValue* typed =
+                dynamic_cast<const Exiv2::UShortValue*>(&value);
+            if (typed != 0 && typed->value_.size() == 1)
+            {
+                return py::int_(typed->value_.front());
+            }
+            return py::none();
+        }
+        case Exiv2::date:
+        {
+            const Exiv2::DateValue* typed =
+                dynamic_cast<const Exiv2::DateValue*>(&value);
+            if (typed == 0)
+            {
+                return py::none();
+            }
+            const Exiv2::DateValue::Date& date = typed->getDate();
+            return py::make_tuple(date.year, date.month, date.day);
+        }
+        case Exiv2::time:
+        {
+            const Exiv2::TimeValue* typed =
+                dynamic_cast<const Exiv2::TimeValue*>(&value);
+            if (typed == 0)
+            {
+                return py::none();
+            }
+            const Exiv2::TimeValue::Time& time = typed->getTime();
+            const char* sign = (time.tzHour < 0 || time.tzMinute < 0) ? "-" : "+";
+            return py::make_tuple(time.hour, time.minute, time.second, sign,
+                                  std::abs(time.tzHour),
+                                  std::abs(time.tzMinute));
+        }
+        default:
+            return py::none();
+    }
+}
+
+// Whether an IPTC datum has the given key, without building its key string.
+static bool hasIptcKey(const Exiv2::Iptcdatum& datum, const Exiv2::IptcKey& key)
+{
+    return datum.tag() == key.tag() && datum.record() == key.record();
+}
+
+// Erase in a single pass the values of an IPTC tag beyond the first keep
+// ones: the other datums are moved up in place, and the freed datums are
+// then erased from the back of the container, which is cheap. IptcData has
+// no range erase, and each erasure invalidates the iterators from the erased
+// datum on, so the datums to keep are counted rather than pointed at.
+static void eraseIptcValues(Exiv2::IptcData& data, const Exiv2::IptcKey& key,
+                            size_t keep)
+{
+    size_t nbValues = 0;
+    const size_t size = static_cast<size_t>(
+        std::remove_if(data.begin(), data.end(),
+                       [&key, &nbValues, keep](const Exiv2::Iptcdatum& datum)
+                       {
+                           return hasIptcKey(datum, key) &&
+                                  (nbValues++ >= keep);
+                       }) - data.begin());
+    while (static_cast<size_t>(data.count()) > size)
+    {
+        data.erase(data.end() - 1);
+    }
+}
+
+// Serialized forms of the value of a datum (of all the values of an IPTC
+// tag), to tell whether setting a value modified the metadata.
+static std::string exifBytes(const Exiv2::Exifdatum& datum)
+{
+    std::string bytes(datum.size() + 1, '\0');
+    bytes[0] = static_cast<char>(datum.typeId());
+    datum.copy(reinterpret_cast<Exiv2::byte*>(&bytes[1]), Exiv2::bigEndian);
+    return bytes;
+}
+
+static std::string iptcBytes(const Exiv2::IptcData& data,
+                             const Exiv2::IptcKey& key)
+{
+    std::string bytes;
+    for (Exiv2::IptcMetadata::const_iterator i = data.begin();
+         i != data.end();
+         ++i)
+    {
+        if (hasIptcKey(*i, key))
+        {
+            std::string value(i->size(), '\0');
+            i->copy(reinterpret_cast<Exiv2::byte*>(&value[0]),
+                    Exiv2::bigEndian);
+            bytes += static_cast<char>(i->typeId());
+            bytes += std::to_string(value.size()) + ':' + value;
+        }
+    }
+    return bytes;
+}
+
+static std::string xmpBytes(const Exiv2::Xmpdatum& datum)
+{
+    return static_cast<char>(datum.typeId()) + datum.toString();
+}
+
+// Integer item of an Exiv2 value, checked against the range of its type.
+template <typename T>
+static T integerItem(const py::handle& item)
+{
+    if (!PyLong_Check(item.ptr()))
+    {
+        throw py::type_error("Expecting an int");
+    }
+    int overflow = 0;
+    long long value = PyLong_AsLongLongAndOverflow(item.ptr(), &overflow);
+    if (overflow != 0 ||
+        value < static_cast<long long>(std::numeric_limits<T>::min()) ||
+        value > static_cast<long long>(std::numeric_limits<T>::max()))
+    {
+        throw py::value_error("Integer out of range: " +
+                              std::string(py::str(item)));
+    }
+    return static_cast<T>(value);
+}
+
+// Rational item of an Exiv2 value, from a (numerator, denominator) tuple.
+template <typename T>
+static std::pair<T, T> rationalItem(const py::handle& item)
+{
+    py::tuple fields = item.cast<py::tuple>();
+    if (fields.size() != 2)
+    {
+        throw py::value_error("Expecting a (numerator, denominator) tuple");
     }
+    return std::make_pair(integerItem<T>(fields[0]),
+                          integerItem<T>(fields[1]));
+}
+
+// Exiv2::ValueType<T> built from a list of items, converted one by one.
+template <typename T, typename Convert>
+static std::unique_ptr<Exiv2::Value> valueFromItems(const py::list& items,
+                                                    Convert convert)
+{
+    std::unique_ptr<Exiv2::ValueType<T> > value(new Exiv2::ValueType<T>());
+    value->value_.reserve(items.size());
+    for (auto item : items)
+    {
+        value->value_.push_back(convert(item));
+    }
+    return std::unique_ptr<Exiv2::Value>(value.release());
+}
+
+// Ascii EXIF value built from a str or from the fields of a date or
+// datetime, formatted as '%Y:%m:%d' or '%Y:%m:%d %H:%M:%S'.
+static std::unique_ptr<Exiv2::Value> exifAsciiFromItem(const py::handle& item)
+{
+    if (!py::isinstance<py::tuple>(item))
+    {
+        return std::unique_ptr<Exiv2::Value>(
+            new Exiv2::AsciiValue(item.cast<std::string>()));
+    }
+    py::tuple fields = item.cast<py::tuple>();
+    int f[6];
+    for (size_t i = 0; i < fields.size() && i < 6; ++i)
+    {
+        f[i] = integerItem<int>(fields[i]);
+    }
+    char buffer[64];
+    if (fields.size() == 3)
+    {
+        snprintf(buffer, sizeof(buffer), "%04d:%02d:%02d", f[0], f[1], f[2]);
+    }
+    else if (fields.size() == 6)
+    {
+        snprintf(buffer, sizeof(buffer), "%04d:%02d:%02d %02d:%02d:%02d",
+                 f[0], f[1], f[2], f[3], f[4], f[5]);
+    }
+    else
+    {
+        throw py::value_error("Expecting the fields of a date or datetime");
+    }
+    return std::unique_ptr<Exiv2::Value>(new Exiv2::AsciiValue(buffer));
+}
 
-    catch (Exiv2::Error& err) 
+// Byte EXIF value (Byte, SByte or Undefined) built from a bytes-like object.
+static std::unique_ptr<Exiv2::Value> exifDataFromItem(Exiv2::TypeId type,
+                                                      const py::handle& item)
+{
+    py::buffer_info info = item.cast<py::buffer>().request();
+    std::unique_ptr<Exiv2::Value> value(new Exiv2::DataValue(type));
+    value->read(static_cast<const Exiv2::byte*>(info.ptr),
+                contiguousSize(info), Exiv2::invalidByteOrder);
+    return value;
+}
+
+// Exiv2 value of an EXIF tag of the given type built from its items (see
+// ExifTag::setTypedValue), 0 for the types not handled.
+static std::unique_ptr<Exiv2::Value> exifValueFromItems(Exiv2::TypeId type,
+                                                        const py::list& items)
+{
+    switch (type)
     {
-        //std::cout << " Caught Exiv2 exception '" << err.code() << "'\n";
-        error = err;
+        case Exiv2::unsignedShort:
+            return valueFromItems<uint16_t>(items, integerItem<uint16_t>);
+        case Exiv2::signedShort:
+            return valueFromItems<int16_t>(items, integerItem<int16_t>);
+        case Exiv2::unsignedLong:
+            return valueFromItems<uint32_t>(items, integerItem<uint32_t>);
+        case Exiv2::signedLong:
+            return valueFromItems<int32_t>(items, integerItem<int32_t>);
+        case Exiv2::unsignedRational:
+            return valueFromItems<Exiv2::URational>(items,
+                                                    rationalItem<uint32_t>);
+        case Exiv2::signedRational:
+            return valueFromItems<Exiv2::Rational>(items,
+                                                   rationalItem<int32_t>);
+        case Exiv2::tiffFloat:
+            return valueFromItems<float>(items,
+                [](const py::handle& item) { return item.cast<float>(); });
+        case Exiv2::tiffDouble:
+            return valueFromItems<double>(items,
+                [](const py::handle& item) { return item.cast<double>(); });
+        case Exiv2::asciiString:
+            if (items.size() == 1)
+            {
+                return exifAsciiFromItem(items[0]);
+            }
+            break;
+        case Exiv2::unsignedByte:
+        case Exiv2::signedByte:
+        case Exiv2::undefined:
+            if (items.size() == 1)
+            {
+                return exifDataFromItem(type, items[0]);
+            }
+            break;
+        default:
+            break;
+    }
+    return std::unique_ptr<Exiv2::Value>();
+}
+
+// Exiv2 value of an IPTC dataset of the given type built from one value (see
+// IptcTag::setTypedValues), 0 for the types not handled.
+static std::unique_ptr<Exiv2::Value> iptcValueFromItem(Exiv2::TypeId type,
+                                                       const py::handle& item)
+{
+    switch (type)
+    {
+        case Exiv2::unsignedShort:
+        {
+            std::unique_ptr<Exiv2::UShortValue> value(new Exiv2::UShortValue);
+            value->value_.push_back(integerItem<uint16_t>(item));
+            return std::unique_ptr<Exiv2::Value>(value.release());
+        }
+        case Exiv2::string:
+            return std::unique_ptr<Exiv2::Value>(
+                new Exiv2::StringValue(item.cast<std::string>()));
+        case Exiv2::date:
+        {
+            py::tuple fields = item.cast<py::tuple>();
+            if (fields.size() != 3)
+            {
+                throw py::value_error("Expecting the fields of a date");
+            }
+            return std::unique_ptr<Exiv2::Value>(new Exiv2::DateValue(
+                integerItem<int32_t>(fields[0]),
+                integerItem<int32_t>(fields[1]),
+                integerItem<int32_t>(fields[2])));
+        }
+        case Exiv2::time:
+        {
+            py::tuple fields = item.cast<py::tuple>();
+            if (fields.size() != 5)
+            {
+                throw py::value_error("Expecting the fields of a time");
+            }
+            return std::unique_ptr<Exiv2::Value>(new Exiv2::TimeValue(
+                integerItem<int32_t>(fields[0]),
+                integerItem<int32_t>(fields[1]),
+                integerItem<int32_t>(fields[2]),
+                integerItem<int32_t>(fields[3]),
+                integerItem<int32_t>(fields[4])));
+        }
+        default:
+            return std::unique_ptr<Exiv2::Value>();
+    }
+}
+
+// Find the datums with the given key in the index of a metadata container,
+// without raising any exception: 0 if the key is not set or is not valid.
+// The key is normalised only if it is not found as is.
+template <typename Key, typename Data>
+static const std::vector<typename Data::iterator>* findKey(
+    KeyIndex<Data>& index, Data& data, const std::string& key,
+    unsigned long changes=0)
+{
+    const auto* datums = index.find(data, key, changes);
+    if (datums == 0)
+    {
+        try
+        {
+            Key canonical(key);
+            if (canonical.key() != key)
+            {
+                datums = index.find(data, canonical.key(), changes);
+            }
+        }
+        catch (Exiv2::Error&)
+        {
+            // Not a valid key
+        }
+    }
+    return datums;
+}
+
+// Errors of the native writes of a file, with the message of errno by
+// default.
+static Exiv2::Error transferError(const std::string& path,
+                                  const std::string& reason=Exiv2::strError())
+{
+#ifdef HAVE_CLASS_ERROR_CODE
+    return Exiv2::Error(Exiv2::ErrorCode::kerTransferFailed, path, reason);
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+    return Exiv2::Error(Exiv2::kerTransferFailed, path, reason);
+#else
+    return Exiv2::Error(18, path, reason);
+#endif
+#endif
+}
+
+static Exiv2::Error renameError(const std::string& from, const std::string& to)
+{
+#ifdef HAVE_CLASS_ERROR_CODE
+    return Exiv2::Error(Exiv2::ErrorCode::kerFileRenameFailed, from, to,
+                        Exiv2::strError());
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+    return Exiv2::Error(Exiv2::kerFileRenameFailed, from, to,
+                        Exiv2::strError());
+#else
+    return Exiv2::Error(17, from, to, Exiv2::strError());
+#endif
+#endif
+}
+
+// Write all the data to a file descriptor.
+static void writeFile(int fd, const std::string& path,
+                      const Exiv2::byte* data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+#ifdef _WIN32
+        int count = _write(fd, data + written, (unsigned int)std::min(
+            size - written, (size_t)std::numeric_limits<int>::max()));
+#else
+        ssize_t count = ::write(fd, data + written, size - written);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+#endif
+        if (count <= 0)
+        {
+            throw transferError(path);
+        }
+        written += count;
+    }
+}
+
+#ifndef _WIN32
+// Keep the times of the original file on the new one if asked, and flush it
+// to the disk before closing it.
+static void closeFile(int& fd, const std::string& path,
+                      const struct stat& original, bool preserveTimestamps)
+{
+    if (preserveTimestamps)
+    {
+#ifdef __APPLE__
+        struct timespec times[2] = {original.st_atimespec,
+                                    original.st_mtimespec};
+#else
+        struct timespec times[2] = {original.st_atim, original.st_mtim};
+#endif
+        if (futimens(fd, times) != 0)
+        {
+            throw transferError(path);
+        }
+    }
+    if (fsync(fd) != 0)
+    {
+        throw transferError(path);
+    }
+    int result = ::close(fd);
+    fd = -1;
+    if (result != 0)
+    {
+        throw transferError(path);
+    }
+}
+#endif
+
+// Replace the file at path with the given data: the data is written to a
+// temporary file next to it, flushed to the disk and renamed over it, so that
+// a crash leaves either the original file or the new one, never a truncated
+// one. The permissions and the owner of the file are kept, and its access and
+// modification times too (to the nanosecond) if asked. A symbolic link is
+// followed, its target being replaced. A file with other hard links, or whose
+// owner can't be kept (only root can give a file away), can't be replaced
+// without breaking the links or giving it away: it is rewritten in place if
+// inPlace, which isn't atomic, and an error is raised otherwise. Called
+// without the GIL.
+static void replaceFile(const std::string& path, const Exiv2::byte* data,
+                        size_t size, bool preserveTimestamps, bool inPlace)
+{
+#ifdef _WIN32
+    std::string temp = path + ".XXXXXX";
+    // No file times with a nanosecond resolution: only the modification time
+    // is kept, through the standard library.
+    std::filesystem::file_time_type mtime =
+        std::filesystem::last_write_time(path);
+    int fd = -1;
+    if (_mktemp_s(&temp[0], temp.size() + 1) == 0)
+    {
+        fd = _open(temp.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY,
+                   _S_IREAD | _S_IWRITE);
+    }
+#else
+    char* resolved = ::realpath(path.c_str(), NULL);
+    if (resolved == NULL)
+    {
+        throw transferError(path);
+    }
+    const std::string target(resolved);
+    free(resolved);
+    struct stat original;
+    if (::stat(target.c_str(), &original) != 0)
+    {
+        throw transferError(target);
+    }
+
+    std::string temp = target + ".XXXXXX";
+    int fd = -1;
+    if (original.st_nlink > 1)
+    {
+        if (!inPlace)
+        {
+            throw transferError(target,
+                "the file has other hard links, it can't be replaced");
+        }
+    }
+    else
+    {
+        fd = mkstemp(&temp[0]);
+        if (fd < 0)
+        {
+            throw transferError(temp);
+        }
+        if (fchown(fd, original.st_uid, original.st_gid) != 0)
+        {
+            const std::string reason = "the owner of the file can't be "
+                "kept, it can't be replaced: " + Exiv2::strError();
+            ::close(fd);
+            ::unlink(temp.c_str());
+            fd = -1;
+            if (!inPlace)
+            {
+                throw transferError(target, reason);
+            }
+        }
+    }
+    if (fd < 0)
+    {
+        // Rewrite the file in place.
+        fd = ::open(target.c_str(), O_WRONLY | O_TRUNC);
+        if (fd < 0)
+        {
+            throw transferError(target);
+        }
+        try
+        {
+            writeFile(fd, target, data, size);
+            closeFile(fd, target, original, preserveTimestamps);
+        }
+        catch (...)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            throw;
+        }
+        return;
+    }
+#endif
+    if (fd < 0)
+    {
+        throw transferError(temp);
+    }
+
+    try
+    {
+        writeFile(fd, temp, data, size);
+
+#ifdef _WIN32
+        if (_commit(fd) != 0)
+        {
+            throw transferError(temp);
+        }
+        _close(fd);
+        fd = -1;
+        if (preserveTimestamps)
+        {
+            std::filesystem::last_write_time(temp, mtime);
+        }
+        if (!MoveFileExA(temp.c_str(), path.c_str(),
+                         MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            throw renameError(temp, path);
+        }
+#else
+        if (fchmod(fd, original.st_mode & 07777) != 0)
+        {
+            throw transferError(temp);
+        }
+        closeFile(fd, temp, original, preserveTimestamps);
+        if (::rename(temp.c_str(), target.c_str()) != 0)
+        {
+            throw renameError(temp, target);
+        }
+
+        // Flush the new entry of the directory as well.
+        size_t slash = target.rfind('/');
+        std::string directory = slash == 0 ? "/" : target.substr(0, slash);
+        int dirfd = ::open(directory.c_str(), O_RDONLY);
+        if (dirfd >= 0)
+        {
+            fsync(dirfd);
+            ::close(dirfd);
+        }
+#endif
+    }
+    catch (...)
+    {
+#ifdef _WIN32
+        if (fd >= 0)
+        {
+            _close(fd);
+        }
+        _unlink(temp.c_str());
+#else
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        ::unlink(temp.c_str());
+#endif
+        throw;
+    }
+}
+
+// Locate the TIFF structure holding the Exif data of an image: the file itself
+// for the TIFF based formats, or the Exif segment of a JPEG stream.
+static bool findExifStructure(const Exiv2::byte* data, size_t size,
+                              size_t& start, size_t& length)
+{
+    static const char exifId[] = "Exif\0";
+
+    if (size >= 4 && (memcmp(data, "II*\0", 4) == 0 ||
+                      memcmp(data, "MM\0*", 4) == 0))
+    {
+        start = 0;
+        length = size;
+        return true;
+    }
+    if (size < 2 || data[0] != 0xff || data[1] != 0xd8)
+    {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size)
+    {
+        if (data[pos] != 0xff)
+        {
+            return false;
+        }
+        const int marker = data[pos + 1];
+        if (marker == 0xff)
+        {
+            // Fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == 0xd9 || marker == 0xda)
+        {
+            // No metadata past the start of the scan
+            return false;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+        {
+            // Markers without a segment
+            pos += 2;
+            continue;
+        }
+        const size_t segment = (data[pos + 2] << 8) | data[pos + 3];
+        if (segment < 2 || pos + 2 + segment > size)
+        {
+            return false;
+        }
+        if (marker == 0xe1 && segment - 2 >= sizeof(exifId) &&
+            memcmp(data + pos + 4, exifId, sizeof(exifId)) == 0)
+        {
+            start = pos + 4 + sizeof(exifId);
+            length = segment - 2 - sizeof(exifId);
+            return true;
+        }
+        pos += 2 + segment;
+    }
+    return false;
+}
+
+// The location in a file of the values of the entries of the IFDs of its Exif
+// data (IFD0, Exif, GPS, interoperability and thumbnail IFDs), for values to be
+// overwritten in place.
+class ExifSlots
+{
+public:
+    struct Slot
+    {
+        Exiv2::TypeId type;
+        uint32_t count;
+        // Offset of the value in the file
+        size_t offset;
+    };
+
+    // Parse the TIFF structure of length bytes at start in data. Return false
+    // if it isn't a valid TIFF structure.
+    bool parse(const Exiv2::byte* data, size_t start, size_t length)
+    {
+        _tiff = data + start;
+        _start = start;
+        _length = length;
+        if (length < 8)
+        {
+            return false;
+        }
+        if (memcmp(_tiff, "II", 2) == 0)
+        {
+            _byteOrder = Exiv2::littleEndian;
+        }
+        else if (memcmp(_tiff, "MM", 2) == 0)
+        {
+            _byteOrder = Exiv2::bigEndian;
+        }
+        else
+        {
+            return false;
+        }
+        if (Exiv2::getUShort(_tiff + 2, _byteOrder) != 42)
+        {
+            return false;
+        }
+        uint32_t next = 0;
+        if (!_parseIfd(Exiv2::getULong(_tiff + 4, _byteOrder), "Image", &next))
+        {
+            return false;
+        }
+        if (next != 0)
+        {
+            _parseIfd(next, "Thumbnail", 0);
+        }
+        return true;
+    }
+
+    Exiv2::ByteOrder byteOrder() const
+    {
+        return _byteOrder;
+    }
+
+    const Slot* find(const std::string& group, uint16_t tag) const
+    {
+        std::map<std::pair<std::string, uint16_t>, Slot>::const_iterator i =
+            _slots.find(std::make_pair(group, tag));
+        return i != _slots.end() ? &i->second : 0;
+    }
+
+private:
+    bool _parseIfd(uint32_t offset, const std::string& group, uint32_t* next)
+    {
+        if (offset < 8 || offset > _length - 2 || !_parsed.insert(offset).second)
+        {
+            return false;
+        }
+        const size_t nbEntries = Exiv2::getUShort(_tiff + offset, _byteOrder);
+        if (offset + 2 + nbEntries * 12 + 4 > _length)
+        {
+            return false;
+        }
+        std::vector<std::pair<uint32_t, std::string> > subIfds;
+        for (size_t i = 0; i < nbEntries; ++i)
+        {
+            const size_t entry = offset + 2 + i * 12;
+            const uint16_t tag = Exiv2::getUShort(_tiff + entry, _byteOrder);
+            const Exiv2::TypeId type = static_cast<Exiv2::TypeId>(
+                Exiv2::getUShort(_tiff + entry + 2, _byteOrder));
+            const uint32_t count = Exiv2::getULong(_tiff + entry + 4,
+                                                   _byteOrder);
+            const uint64_t size =
+                static_cast<uint64_t>(count) * Exiv2::TypeInfo::typeSize(type);
+            if (size == 0)
+            {
+                // Unknown type
+                continue;
+            }
+            size_t value = entry + 8;
+            if (size > 4)
+            {
+                value = Exiv2::getULong(_tiff + entry + 8, _byteOrder);
+                if (value > _length || size > _length - value)
+                {
+                    continue;
+                }
+            }
+            Slot slot = {type, count, _start + value};
+            _slots.insert(std::make_pair(std::make_pair(group, tag), slot));
+
+            if (count == 1 &&
+                (type == Exiv2::unsignedLong || type == Exiv2::tiffIfd))
+            {
+                const uint32_t pointer = Exiv2::getULong(_tiff + value,
+                                                         _byteOrder);
+                if (group == "Image" && tag == 0x8769)
+                {
+                    subIfds.push_back(std::make_pair(pointer, "Photo"));
+                }
+                else if (group == "Image" && tag == 0x8825)
+                {
+                    subIfds.push_back(std::make_pair(pointer, "GPSInfo"));
+                }
+                else if (group == "Photo" && tag == 0xa005)
+                {
+                    subIfds.push_back(std::make_pair(pointer, "Iop"));
+                }
+            }
+        }
+        if (next != 0)
+        {
+            *next = Exiv2::getULong(_tiff + offset + 2 + nbEntries * 12,
+                                    _byteOrder);
+        }
+        for (size_t i = 0; i < subIfds.size(); ++i)
+        {
+            _parseIfd(subIfds[i].first, subIfds[i].second, 0);
+        }
+        return true;
+    }
+
+    const Exiv2::byte* _tiff;
+    size_t _start;
+    size_t _length;
+    Exiv2::ByteOrder _byteOrder;
+    std::map<std::pair<std::string, uint16_t>, Slot> _slots;
+    std::unordered_set<uint32_t> _parsed;
+};
+
+// Errors of the native opening of a file, with the message of errno.
+static Exiv2::Error openError(const std::string& path)
+{
+#ifdef HAVE_CLASS_ERROR_CODE
+    return Exiv2::Error(Exiv2::ErrorCode::kerDataSourceOpenFailed, path,
+                        Exiv2::strError());
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+    return Exiv2::Error(Exiv2::kerDataSourceOpenFailed, path,
+                        Exiv2::strError());
+#else
+    return Exiv2::Error(9, path, Exiv2::strError());
+#endif
+#endif
+}
+
+// Size of the beginning of a mapped file read ahead, where the metadata of
+// most images starts.
+static const size_t MAPPED_HEAD_SIZE = 64 * 1024;
+
+MappedFile::MappedFile(const std::string& path): _data(0), _size(0)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE |
+                              FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw openError(path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        throw openError(path);
+    }
+    _size = (size_t)size.QuadPart;
+    if (_size > 0)
+    {
+        // The view keeps the mapping alive.
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                            NULL);
+        if (mapping != NULL)
+        {
+            _data = (Exiv2::byte*)MapViewOfFile(mapping, FILE_MAP_READ,
+                                                0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw openError(path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw openError(path);
+    }
+    _size = (size_t)info.st_size;
+    if (_size > 0)
+    {
+        void* data = ::mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            _data = (Exiv2::byte*)data;
+            // Only the pages accessed by the parsers are read, without
+            // reading ahead, but for the beginning of the file.
+            madvise(_data, _size, MADV_RANDOM);
+            madvise(_data, std::min(_size, MAPPED_HEAD_SIZE), MADV_WILLNEED);
+        }
+    }
+    ::close(fd);
+#endif
+    if (_size > 0 && _data == 0)
+    {
+        throw openError(path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != 0)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        ::munmap(_data, _size);
+#endif
+    }
+}
+
+void MappedFile::adviseSequential() const
+{
+#ifndef _WIN32
+    if (_data != 0)
+    {
+        madvise(_data, _size, MADV_SEQUENTIAL);
+    }
+#endif
+}
+
+py::buffer_info MappedFile::getBuffer()
+{
+    return py::buffer_info(_data, sizeof(Exiv2::byte),
+                           py::format_descriptor<Exiv2::byte>::format(),
+                           1, {(py::ssize_t)_size},
+                           {(py::ssize_t)sizeof(Exiv2::byte)}, true);
+}
+
+// A read-only stream of Exiv2 on a source read through a window over its data
+// (see PythonIo and RangeIo): reads within the window are copies, the window
+// being moved to the position read when needed, and large reads go straight
+// to the source. Only mmap() reads the whole image, as some formats (e.g.
+// TIFF) are parsed in memory.
+class WindowedIo : public Exiv2::BasicIo
+{
+public:
+    WindowedIo(size_t directSize):
+        _size(0), _window(0), _windowStart(0), _windowLength(0),
+        _error(false), _directSize(std::max(directSize, (size_t)1)),
+        _position(0), _open(false), _eof(false)
+    {
+    }
+
+    int open() override
+    {
+        _position = 0;
+        _open = true;
+        _eof = false;
+        return 0;
+    }
+
+    int close() override
+    {
+        _open = false;
+        munmap();
+        return 0;
+    }
+
+    // The stream is read-only (see Image::writeMetadata).
+    size_t write(const Exiv2::byte*, size_t) override
+    {
+        return 0;
+    }
+
+    size_t write(Exiv2::BasicIo&) override
+    {
+        return 0;
+    }
+
+    int putb(Exiv2::byte) override
+    {
+        return EOF;
+    }
+
+    void transfer(Exiv2::BasicIo&) override
+    {
+#ifdef HAVE_CLASS_ERROR_CODE
+        throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage,
+                           "image opened read-only, cannot be written");
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+        throw Exiv2::Error(Exiv2::kerErrorMessage,
+                           "image opened read-only, cannot be written");
+#else
+        throw Exiv2::Error(1, "image opened read-only, cannot be written");
+#endif
+#endif
+    }
+
+    Exiv2::DataBuf read(size_t count) override
+    {
+        Exiv2::DataBuf data(count);
+        data.resize(read(data.data(), count));
+        return data;
+    }
+
+    size_t read(Exiv2::byte* dest, size_t count) override
+    {
+        size_t total = 0;
+        while (total < count && _position < _size)
+        {
+            if (!_inWindow())
+            {
+                const size_t remaining = std::min(count - total,
+                                                  _size - _position);
+                if (remaining >= _directSize)
+                {
+                    const size_t read = _readDirect(_position, dest + total,
+                                                    remaining);
+                    total += read;
+                    _position += read;
+                    if (read < remaining)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+                if (!_load(_position) || !_inWindow())
+                {
+                    break;
+                }
+            }
+            const size_t offset = _position - _windowStart;
+            const size_t read = std::min(count - total,
+                                         _windowLength - offset);
+            std::memcpy(dest + total, _window + offset, read);
+            total += read;
+            _position += read;
+        }
+        if (total < count)
+        {
+            _eof = true;
+        }
+        return total;
+    }
+
+    int getb() override
+    {
+        if (_position >= _size ||
+            (!_inWindow() && (!_load(_position) || !_inWindow())))
+        {
+            _eof = true;
+            return EOF;
+        }
+        return _window[_position++ - _windowStart];
+    }
+
+    int seek(int64_t offset, Exiv2::BasicIo::Position position) override
+    {
+        int64_t target = offset;
+        if (position == Exiv2::BasicIo::cur)
+        {
+            target += static_cast<int64_t>(_position);
+        }
+        else if (position == Exiv2::BasicIo::end)
+        {
+            target += static_cast<int64_t>(_size);
+        }
+        if (target < 0)
+        {
+            return 1;
+        }
+        if (static_cast<uint64_t>(target) > _size)
+        {
+            _eof = true;
+            return 1;
+        }
+        _position = static_cast<size_t>(target);
+        _eof = false;
+        return 0;
+    }
+
+    Exiv2::byte* mmap(bool) override
+    {
+        if (_whole.size() != _size)
+        {
+            _whole.resize(_size);
+            if (_readDirect(0, _whole.data(), _size) != _size)
+            {
+                _whole.clear();
+#ifdef HAVE_CLASS_ERROR_CODE
+                throw Exiv2::Error(Exiv2::ErrorCode::kerFailedToReadImageData);
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+                throw Exiv2::Error(Exiv2::kerFailedToReadImageData);
+#else
+                throw Exiv2::Error(14);
+#endif
+#endif
+            }
+        }
+        return _whole.data();
+    }
+
+    int munmap() override
+    {
+        std::vector<Exiv2::byte>().swap(_whole);
+        return 0;
+    }
+
+    size_t tell() const override
+    {
+        return _position;
+    }
+
+    size_t size() const override
+    {
+        return _size;
+    }
+
+    bool isopen() const override
+    {
+        return _open;
+    }
+
+    int error() const override
+    {
+        return _error ? 1 : 0;
+    }
+
+    bool eof() const override
+    {
+        return _eof;
+    }
+
+    const std::string& path() const noexcept override
+    {
+        return _path;
+    }
+
+    void populateFakeData() override
+    {
+    }
+
+protected:
+    // Move the window to the data at position. Return false if it can't be
+    // read.
+    virtual bool _load(size_t position) = 0;
+    // Read count bytes at position into dest, bypassing the window.
+    virtual size_t _readDirect(size_t position, Exiv2::byte* dest,
+                               size_t count) = 0;
+
+    std::string _path;
+    size_t _size;
+    const Exiv2::byte* _window;
+    size_t _windowStart;
+    size_t _windowLength;
+    bool _error;
+
+private:
+    bool _inWindow() const
+    {
+        return _window != 0 && _position >= _windowStart &&
+               _position < _windowStart + _windowLength;
+    }
+
+    // Size of the reads bypassing the window.
+    size_t _directSize;
+    // Position of the stream in the image.
+    size_t _position;
+    // The whole image, while mapped.
+    std::vector<Exiv2::byte> _whole;
+    bool _open;
+    bool _eof;
+};
+
+// Report the exception being handled, thrown while calling a Python object
+// from a read of Exiv2 that can't raise it, as unraisable on that object.
+// The exceptions of pybind11 (e.g. a failed cast) and of the standard library
+// are converted to Python exceptions first. Called with the GIL.
+static void discardReadError(const py::object& object)
+{
+    try
+    {
+        try
+        {
+            throw;
+        }
+        catch (py::error_already_set&)
+        {
+            throw;
+        }
+        catch (py::builtin_exception& error)
+        {
+            error.set_error();
+            throw py::error_already_set();
+        }
+        catch (std::exception& error)
+        {
+            PyErr_SetString(PyExc_RuntimeError, error.what());
+            throw py::error_already_set();
+        }
+    }
+    catch (py::error_already_set& error)
+    {
+        error.discard_as_unraisable(object);
+    }
+}
+
+// A stream on a Python binary file object (e.g. an io.BufferedReader), from
+// its position when opened. The data is pulled through the readinto(), seek()
+// and tell() methods of the object into a read-ahead buffer, the GIL being
+// acquired only to refill it: the parsers of Exiv2 only read the parts of the
+// image they need.
+class PythonIo : public WindowedIo
+{
+public:
+    // Called with the GIL. The stream is left at its position.
+    PythonIo(const py::object& stream, size_t bufferSize):
+        WindowedIo(bufferSize), _stream(stream),
+        _buffer(std::max(bufferSize, (size_t)1))
+    {
+        _base = stream.attr("tell")().cast<size_t>();
+        const size_t end = stream.attr("seek")(0, 2).cast<size_t>();
+        stream.attr("seek")(_base);
+        _size = end > _base ? end - _base : 0;
+        py::object name = py::getattr(stream, "name", py::none());
+        _path = py::isinstance<py::str>(name) ? name.cast<std::string>()
+                                              : "<stream>";
+    }
+
+    ~PythonIo() override
+    {
+        // The object may be released without the GIL (see
+        // Image::_instantiate_image).
+        py::gil_scoped_acquire acquire;
+        _stream = py::object();
+    }
+
+protected:
+    bool _load(size_t position) override
+    {
+        _window = _buffer.data();
+        _windowStart = position;
+        _windowLength = _readDirect(
+            position, _buffer.data(),
+            std::min(_buffer.size(), _size - position));
+        return _windowLength > 0;
+    }
+
+    // Read under the GIL, always seeking first: the object may have been
+    // moved by its other users since the last read. An exception raised by
+    // the object, or by the conversion of its results, is reported as
+    // unraisable, and ends the read.
+    size_t _readDirect(size_t position, Exiv2::byte* dest,
+                       size_t count) override
+    {
+        py::gil_scoped_acquire acquire;
+        size_t total = 0;
+        try
+        {
+            _stream.attr("seek")(_base + position);
+            while (total < count)
+            {
+                py::object view = py::memoryview::from_memory(
+                    dest + total, (py::ssize_t)(count - total));
+                py::object read = _stream.attr("readinto")(view);
+                const size_t length = read.is_none() ? 0 : read.cast<size_t>();
+                if (length == 0)
+                {
+                    break;
+                }
+                total += length;
+            }
+        }
+        catch (std::exception&)
+        {
+            discardReadError(_stream);
+            _error = true;
+        }
+        return total;
+    }
+
+private:
+    py::object _stream;
+    // Position of the image in the object.
+    size_t _base;
+    std::vector<Exiv2::byte> _buffer;
+};
+
+// A stream on an object of a remote store, read through a Python callable
+// fetching a range of bytes: fetch(offset, length) returns the bytes (or any
+// object supporting the buffer protocol). The object is read by blocks,
+// cached in a LRU list, a miss fetching the following blocks as well in the
+// same request. The GIL is acquired only to fetch.
+class RangeIo : public WindowedIo
+{
+public:
+    RangeIo(const py::object& fetch, size_t size, size_t blockSize,
+            size_t cacheBlocks, size_t readahead):
+        WindowedIo(std::max(blockSize, (size_t)1)), _fetch(fetch),
+        _blockSize(std::max(blockSize, (size_t)1)), _readahead(readahead),
+        _cacheBlocks(std::max(cacheBlocks, readahead + 1))
+    {
+        _size = size;
+        _path = "<range>";
+    }
+
+    ~RangeIo() override
+    {
+        // The callable may be released without the GIL (see
+        // Image::_instantiate_image).
+        py::gil_scoped_acquire acquire;
+        _fetch = py::object();
+    }
+
+protected:
+    bool _load(size_t position) override
+    {
+        const size_t index = position / _blockSize;
+        Blocks::iterator block = _find(index);
+        if (block == _blocks.end())
+        {
+            // Fetch the block with the following ones not cached.
+            size_t count = 1;
+            while (count <= _readahead &&
+                   (index + count) * _blockSize < _size &&
+                   _index.count(index + count) == 0)
+            {
+                ++count;
+            }
+            const size_t start = index * _blockSize;
+            const size_t length = std::min(count * _blockSize, _size - start);
+            std::vector<Exiv2::byte> data(length);
+            if (_readDirect(start, data.data(), length) != length)
+            {
+                return false;
+            }
+            for (size_t i = count; i-- > 0;)
+            {
+                const size_t offset = i * _blockSize;
+                _insert(index + i, std::vector<Exiv2::byte>(
+                    data.begin() + offset,
+                    data.begin() + std::min(offset + _blockSize, length)));
+            }
+            block = _blocks.begin();
+        }
+        _window = block->second.data();
+        _windowStart = index * _blockSize;
+        _windowLength = block->second.size();
+        return true;
+    }
+
+    // Fetch under the GIL. An exception raised by the callable is reported
+    // as unraisable, and fails the read.
+    size_t _readDirect(size_t position, Exiv2::byte* dest,
+                       size_t count) override
+    {
+        py::gil_scoped_acquire acquire;
+        try
+        {
+            py::object data = _fetch(position, count);
+            if (!PyObject_CheckBuffer(data.ptr()))
+            {
+                throw py::type_error("fetch must return a bytes-like object");
+            }
+            py::buffer_info info =
+                py::reinterpret_borrow<py::buffer>(data).request();
+            const size_t size = std::min((size_t)contiguousSize(info), count);
+            std::memcpy(dest, info.ptr, size);
+            return size;
+        }
+        catch (std::exception&)
+        {
+            discardReadError(_fetch);
+            _error = true;
+            return 0;
+        }
+    }
+
+private:
+    typedef std::list<std::pair<size_t, std::vector<Exiv2::byte> > > Blocks;
+
+    // Find a block, and move it to the front of the list.
+    Blocks::iterator _find(size_t index)
+    {
+        std::unordered_map<size_t, Blocks::iterator>::iterator found =
+            _index.find(index);
+        if (found == _index.end())
+        {
+            return _blocks.end();
+        }
+        _blocks.splice(_blocks.begin(), _blocks, found->second);
+        return found->second;
+    }
+
+    // Add a block to the front of the list, evicting the least recently
+    // used ones.
+    void _insert(size_t index, std::vector<Exiv2::byte> data)
+    {
+        _blocks.emplace_front(index, std::move(data));
+        _index[index] = _blocks.begin();
+        while (_blocks.size() > _cacheBlocks)
+        {
+            if (_window == _blocks.back().second.data())
+            {
+                _window = 0;
+            }
+            _index.erase(_blocks.back().first);
+            _blocks.pop_back();
+        }
+    }
+
+    py::object _fetch;
+    size_t _blockSize;
+    size_t _readahead;
+    size_t _cacheBlocks;
+    Blocks _blocks;
+    std::unordered_map<size_t, Blocks::iterator> _index;
+};
+
+void Image::_instantiate_image()
+{
+    _exifThumbnail = 0;
+
+    // The stream is created under the GIL.
+    Exiv2::BasicIo::UniquePtr io;
+    if (_openIo)
+    {
+        io.reset(_openIo());
+    }
+
+    // Release the GIL to allow other python threads to run
+    // while opening the file.
+    withoutGil([&] {
+        if (io)
+        {
+            const std::string path = io->path();
+            _image = Exiv2::ImageFactory::open(std::move(io));
+            if (!_image)
+            {
+#ifdef HAVE_CLASS_ERROR_CODE
+                throw Exiv2::Error(
+                    Exiv2::ErrorCode::kerFileContainsUnknownImageType, path);
+#else
+#ifdef HAVE_EXIV2_ERROR_CODE
+                throw Exiv2::Error(Exiv2::kerFileContainsUnknownImageType,
+                                   path);
+#else
+                throw Exiv2::Error(11, path);
+#endif
+#endif
+            }
+        }
+        else if (_data != 0)
+        {
+            _image = Exiv2::ImageFactory::open(_data, _size);
+        }
+        else
+        {
+            _image = Exiv2::ImageFactory::open(_filename);
+        }
+    });
+
+    assert(_image.get() != 0);
+    _dataRead = false;
+    _exifRead = _iptcRead = _xmpRead = false;
+    _partialRead = false;
+    _pixelWidth = _pixelHeight = 0;
+}
+
+// Base constructor
+Image::Image(const std::string& filename)
+{
+    _state = std::make_shared<ImageState>();
+    _filename = filename;
+    _data = 0;
+    _instantiate_image();
+}
+
+Image::Image(const std::string& filename, bool mapped)
+{
+    _state = std::make_shared<ImageState>();
+    _filename = filename;
+    _data = 0;
+    if (mapped)
+    {
+        std::shared_ptr<MappedFile> mapping;
+        withoutGil([&] {
+            mapping = std::make_shared<MappedFile>(filename);
+        });
+        // An empty file is opened by Exiv2, to report it.
+        if (mapping->size() > 0)
+        {
+            _mapping = mapping;
+            _data = _mapping->data();
+            _size = (long)_mapping->size();
+        }
+    }
+    _instantiate_image();
+}
+
+// From stream constructor
+Image::Image(const std::function<Exiv2::BasicIo*()>& openIo)
+{
+    _state = std::make_shared<ImageState>();
+    _data = 0;
+    _size = 0;
+    _openIo = openIo;
+    _instantiate_image();
+}
+
+// From buffer constructor
+Image::Image(py::buffer buffer, long size)
+{
+    _state = std::make_shared<ImageState>();
+
+    // Request a read-only view on the object: the data is never copied,
+    // Exiv2 reads it in place and only allocates its own memory if the
+    // metadata is written back.
+    _bufferInfo = std::make_shared<py::buffer_info>(buffer.request());
+
+    py::ssize_t nbytes = contiguousSize(*_bufferInfo);
+    if (size < 0 || size > nbytes)
+    {
+        throw py::value_error("Invalid image buffer size");
+    }
+
+    _data = static_cast<const Exiv2::byte*>(_bufferInfo->ptr);
+    _size = size;
+    _instantiate_image();
+}
+
+// From an already opened and read image
+Image::Image(const std::string& filename, Exiv2::Image::UniquePtr image)
+{
+    _state = std::make_shared<ImageState>();
+    _filename = filename;
+    _data = 0;
+    _size = 0;
+    _exifThumbnail = 0;
+    _image = std::move(image);
+    _exifData = &_image->exifData();
+    _iptcData = &_image->iptcData();
+    _xmpData = &_image->xmpData();
+    _dataRead = true;
+    _exifRead = _iptcRead = _xmpRead = true;
+    _partialRead = false;
+    _pixelWidth = _pixelHeight = 0;
+}
+
+// Copy constructor
+Image::Image(const Image& image)
+{
+    // The copy is a distinct image, with its own lock.
+    _state = std::make_shared<ImageState>();
+    {
+        ImageLock lock(image._state);
+        _filename = image._filename;
+        _data = image._data;
+        _size = image._size;
+        _bufferInfo = image._bufferInfo;
+        _mapping = image._mapping;
+        _openIo = image._openIo;
+        _sidecarPath = image._sidecarPath;
+    }
+    _instantiate_image();
+}
+
+Image::~Image()
+{
+    if (_exifThumbnail != 0)
+    {
+        delete _exifThumbnail;
+    }
+}
+
+// Read the segments of a JPEG image holding the requested metadata families
+// and decode them with the parsers of Exiv2, the other segments being
+// skipped: the parsers of the families not requested are never invoked.
+// The comment, the ICC profile and the dimensions of the picture (which can't
+// be set on the Exiv2 image, hence width and height) are read as Exiv2 does.
+// Return false if the stream is not a well-formed JPEG stream, in which case
+// the metadata has to be read by Exiv2.
+static bool readJpegMetadata(Exiv2::Image& image,
+                             bool exif, bool iptc, bool xmp,
+                             unsigned int& width, unsigned int& height)
+{
+    static const char exifId[] = "Exif\0";
+    static const char xmpId[] = "http://ns.adobe.com/xap/1.0/";
+    static const char psId[] = "Photoshop 3.0";
+    static const char iccId[] = "ICC_PROFILE";
+    // The identifier is followed by the index and number of the chunk
+    static const size_t iccHeader = sizeof(iccId) + 2;
+
+    Exiv2::BasicIo& io = image.io();
+    if (io.open() != 0)
+    {
+        return false;
+    }
+    Exiv2::IoCloser closer(io);
+
+    if (io.getb() != 0xff || io.getb() != 0xd8)
+    {
+        return false;
+    }
+
+    std::vector<Exiv2::byte> exifBlob;
+    std::vector<Exiv2::byte> psBlob;
+    std::vector<Exiv2::byte> iccBlob;
+    std::string xmpPacket;
+    std::string comment;
+    bool exifFound = false;
+    bool commentFound = false;
+    width = height = 0;
+    for (;;)
+    {
+        int marker = io.getb();
+        if (marker == EOF)
+        {
+            break;
+        }
+        if (marker != 0xff)
+        {
+            return false;
+        }
+        // Skip the fill bytes
+        while (marker == 0xff)
+        {
+            marker = io.getb();
+        }
+        if (marker == EOF || marker == 0xd9 || marker == 0xda)
+        {
+            // No metadata past the start of the scan
+            break;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+        {
+            // Markers without a segment
+            continue;
+        }
+
+        Exiv2::byte length[2];
+        if (io.read(length, 2) != 2)
+        {
+            return false;
+        }
+        size_t size = (length[0] << 8) | length[1];
+        if (size < 2)
+        {
+            return false;
+        }
+        size -= 2;
+
+        // Start of frame, except DHT, JPG and DAC
+        bool sof = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 &&
+                   marker != 0xc8 && marker != 0xcc;
+        bool wanted = (marker == 0xe1 && (exif || xmp)) ||
+                      (marker == 0xed && iptc) || marker == 0xe2 ||
+                      (marker == 0xfe && !commentFound) ||
+                      (sof && height == 0);
+        if (!wanted)
+        {
+            if (io.seek(static_cast<int64_t>(size), Exiv2::BasicIo::cur) != 0)
+            {
+                return false;
+            }
+            continue;
+        }
+        std::vector<Exiv2::byte> segment(size);
+        if (static_cast<size_t>(io.read(segment.data(), size)) != size)
+        {
+            return false;
+        }
+
+        if (sof)
+        {
+            if (size >= 5)
+            {
+                height = (segment[1] << 8) | segment[2];
+                width = (segment[3] << 8) | segment[4];
+            }
+        }
+        else if (marker == 0xfe)
+        {
+            // Only the first comment is read, without its trailing nulls
+            comment.assign(reinterpret_cast<const char*>(segment.data()),
+                           size);
+            comment.erase(comment.find_last_not_of('\0') + 1);
+            commentFound = true;
+        }
+        else if (marker == 0xe2)
+        {
+            // The ICC profile is split in chunks, in order
+            if (size > iccHeader &&
+                memcmp(segment.data(), iccId, sizeof(iccId)) == 0)
+            {
+                iccBlob.insert(iccBlob.end(), segment.begin() + iccHeader,
+                               segment.end());
+            }
+        }
+        else if (marker == 0xed)
+        {
+            // The IPTC data is in an IRB of the Photoshop segments
+            if (size >= sizeof(psId) &&
+                memcmp(segment.data(), psId, sizeof(psId)) == 0)
+            {
+                psBlob.insert(psBlob.end(), segment.begin() + sizeof(psId),
+                              segment.end());
+            }
+        }
+        else if (exif && !exifFound && size >= sizeof(exifId) &&
+                 memcmp(segment.data(), exifId, sizeof(exifId)) == 0)
+        {
+            exifBlob.assign(segment.begin() + sizeof(exifId), segment.end());
+            exifFound = true;
+        }
+        else if (xmp && xmpPacket.empty() && size >= sizeof(xmpId) &&
+                 memcmp(segment.data(), xmpId, sizeof(xmpId)) == 0)
+        {
+            xmpPacket.assign(
+                reinterpret_cast<const char*>(segment.data()) + sizeof(xmpId),
+                size - sizeof(xmpId));
+        }
+    }
+
+    if (!exifBlob.empty())
+    {
+        image.setByteOrder(Exiv2::ExifParser::decode(
+            image.exifData(), exifBlob.data(), exifBlob.size()));
+        if (image.byteOrder() == Exiv2::invalidByteOrder)
+        {
+            image.exifData().clear();
+        }
+    }
+
+    if (!psBlob.empty())
+    {
+        std::vector<Exiv2::byte> iptcBlob;
+        const Exiv2::byte* current = psBlob.data();
+        const Exiv2::byte* end = current + psBlob.size();
+        const Exiv2::byte* record = 0;
+        uint32_t sizeHeader = 0;
+        uint32_t sizeIptc = 0;
+        while (current < end &&
+               Exiv2::Photoshop::locateIptcIrb(current, end - current,
+                                               &record, sizeHeader,
+                                               sizeIptc) == 0)
+        {
+            iptcBlob.insert(iptcBlob.end(), record + sizeHeader,
+                            record + sizeHeader + sizeIptc);
+            current = record + sizeHeader + sizeIptc + (sizeIptc & 1);
+        }
+        if (!iptcBlob.empty() &&
+            Exiv2::IptcParser::decode(image.iptcData(), iptcBlob.data(),
+                                      iptcBlob.size()) != 0)
+        {
+            image.iptcData().clear();
+        }
+    }
+
+    if (!xmpPacket.empty() &&
+        Exiv2::XmpParser::decode(image.xmpData(), xmpPacket) > 1)
+    {
+        image.xmpData().clear();
+    }
+
+    image.setComment(comment);
+    if (!iccBlob.empty())
+    {
+        image.setIccProfile(Exiv2::DataBuf(iccBlob.data(), iccBlob.size()));
+    }
+    return true;
+}
+
+// Erase the tags of the makernotes from EXIF data.
+static void eraseMakernoteTags(Exiv2::ExifData& data)
+{
+    Exiv2::ExifData::iterator i = data.begin();
+    while (i != data.end())
+    {
+        if (Exiv2::ExifTags::isMakerGroup(i->groupName()))
+        {
+            i = data.erase(i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void Image::readMetadata(bool exif, bool iptc, bool xmp, bool makernote)
+{
+    ImageLock lock(_state);
+    initialiseXmpToolkit();
+
+    // Release the GIL to allow other python threads to run
+    // while reading metadata.
+    withoutGil([&] {
+        std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+        bool partial = !(exif && iptc && xmp && makernote);
+        _pixelWidth = _pixelHeight = 0;
+        if (!partial)
+        {
+            _image->readMetadata();
+        }
+        else
+        {
+            _image->clearMetadata();
+            if (_image->imageType() != Exiv2::ImageType::jpeg ||
+                !readJpegMetadata(*_image, exif, iptc, xmp, _pixelWidth,
+                                  _pixelHeight))
+            {
+                // Read everything, and drop the families not requested
+                _pixelWidth = _pixelHeight = 0;
+                _image->readMetadata();
+                if (!exif)
+                {
+                    _image->clearExifData();
+                }
+                if (!iptc)
+                {
+                    _image->clearIptcData();
+                }
+                if (!xmp)
+                {
+                    _image->clearXmpData();
+                }
+            }
+            if (!makernote)
+            {
+                eraseMakernoteTags(_image->exifData());
+            }
+        }
+        if (!_sidecarPath.empty())
+        {
+            _embeddedXmp = _image->xmpData();
+            if (xmp)
+            {
+                _readXmpSidecar();
+            }
+        }
+        _exifData = &_image->exifData();
+        _iptcData = &_image->iptcData();
+        _xmpData = &_image->xmpData();
+        _exifRead = exif;
+        _iptcRead = iptc;
+        _xmpRead = xmp;
+        _partialRead = partial;
+        _exifIndex.invalidate();
+        _iptcIndex.invalidate();
+        _xmpIndex.invalidate();
+        _state->modified = 0;
+        _dataRead = true;
+    });
+}
+
+void Image::_checkWritable() const
+{
+    CHECK_METADATA_READ
+    if (_partialRead)
+    {
+        // The families or the makernotes not read would be erased.
+#ifdef HAVE_CLASS_ERROR_CODE
+        throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage,
+                           "metadata partially read, cannot be written");
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+        throw Exiv2::Error(Exiv2::kerErrorMessage,
+                           "metadata partially read, cannot be written");
+#else
+        throw Exiv2::Error(METADATA_NOT_READ);
+#endif
+#endif
+    }
+}
+
+// Put the XMP metadata embedded in an image in place of the one merged with
+// its sidecar for the scope of a write of the image (see setXmpSidecar). The
+// data is swapped, not copied, so that the tags keep pointing to their datums.
+class EmbeddedXmp
+{
+public:
+    EmbeddedXmp(Exiv2::XmpData& xmpData, Exiv2::XmpData& embedded,
+                bool enabled):
+        _xmpData(xmpData), _embedded(embedded), _enabled(enabled)
+    {
+        if (_enabled)
+        {
+            std::swap(_xmpData, _embedded);
+        }
+    }
+
+    ~EmbeddedXmp()
+    {
+        if (_enabled)
+        {
+            std::swap(_xmpData, _embedded);
+        }
+    }
+
+private:
+    Exiv2::XmpData& _xmpData;
+    Exiv2::XmpData& _embedded;
+    bool _enabled;
+};
+
+bool Image::writeMetadata(bool patch)
+{
+    ImageLock lock(_state);
+    _checkWritable();
+    if (_state->modified == 0)
+    {
+        // Nothing to write.
+        return false;
+    }
+    if ((_mapping || _openIo) && _imageModified() != 0)
+    {
+#ifdef HAVE_CLASS_ERROR_CODE
+        throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage,
+                           "image opened read-only, cannot be written");
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+        throw Exiv2::Error(Exiv2::kerErrorMessage,
+                           "image opened read-only, cannot be written");
+#else
+        throw Exiv2::Error(1, "image opened read-only, cannot be written");
+#endif
+#endif
+    }
+
+    initialiseXmpToolkit();
+
+    std::exception_ptr error;
+    try
+    {
+        // Release the GIL to allow other python threads to run
+        // while writing metadata.
+        withoutGil([&] {
+            std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+            if (!_sidecarPath.empty() &&
+                (_state->modified & ImageState::xmp))
+            {
+                _writeXmpSidecar();
+            }
+            if (_imageModified() != 0 && (!patch || !_patchExifData()))
+            {
+                EmbeddedXmp embedded(_image->xmpData(), _embeddedXmp,
+                                     !_sidecarPath.empty());
+                _image->writeMetadata();
+            }
+        });
+    }
+
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // Encoding the metadata may have altered it (e.g. removed tags too large
+    // for the image format), even if it failed.
+    _exifIndex.invalidate();
+    _iptcIndex.invalidate();
+    _xmpIndex.invalidate();
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    _state->modified = 0;
+    return true;
+}
+
+bool Image::_patchExifData()
+{
+    if (_data != 0 || _openIo || _imageModified() != ImageState::exif)
+    {
+        return false;
+    }
+    Exiv2::FileIo file(_filename);
+    if (file.open("r+b") != 0)
+    {
+        return false;
+    }
+    Exiv2::IoCloser closer(file);
+
+    // The changes to write, as the offsets in the file of the values with
+    // their new bytes.
+    std::vector<std::pair<size_t, std::vector<Exiv2::byte> > > patches;
+    {
+        const Exiv2::byte* data = file.mmap();
+        size_t start = 0;
+        size_t length = 0;
+        ExifSlots slots;
+        if (!findExifStructure(data, file.size(), start, length) ||
+            !slots.parse(data, start, length))
+        {
+            file.munmap();
+            return false;
+        }
+
+        // The Exif data of the file, to find the tags modified. No tag may
+        // have been added nor removed.
+        Exiv2::ExifData original;
+        Exiv2::ExifParser::decode(original, data + start, length);
+        bool patchable = original.count() == _exifData->count();
+        Exiv2::ExifData::const_iterator before = original.begin();
+        Exiv2::ExifData::const_iterator after = _exifData->begin();
+        for (; patchable && after != _exifData->end(); ++before, ++after)
+        {
+            if (before->key() != after->key() ||
+                before->typeId() != after->typeId() ||
+                before->count() != after->count() ||
+                before->size() != after->size())
+            {
+                patchable = false;
+            }
+            else if (exifBytes(*before) != exifBytes(*after))
+            {
+                // The tag must be in one of the IFDs located, with the same
+                // type and count, and its value where the entry says it is.
+                const ExifSlots::Slot* slot =
+                    slots.find(after->groupName(), after->tag());
+                const size_t size = after->size();
+                std::vector<Exiv2::byte> value(size);
+                if (slot == 0 || slot->type != after->typeId() ||
+                    slot->count != after->count() ||
+                    size != slot->count * Exiv2::TypeInfo::typeSize(slot->type))
+                {
+                    patchable = false;
+                    break;
+                }
+                before->copy(value.data(), slots.byteOrder());
+                if (memcmp(data + slot->offset, value.data(), size) != 0)
+                {
+                    patchable = false;
+                    break;
+                }
+                after->copy(value.data(), slots.byteOrder());
+                patches.push_back(std::make_pair(slot->offset, value));
+            }
+        }
+        file.munmap();
+        if (!patchable)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < patches.size(); ++i)
+    {
+        const std::vector<Exiv2::byte>& value = patches[i].second;
+        if (file.seek(static_cast<int64_t>(patches[i].first),
+                      Exiv2::BasicIo::beg) != 0 ||
+            static_cast<size_t>(file.write(value.data(), value.size())) !=
+                value.size())
+        {
+            throw transferError(_filename);
+        }
+    }
+    if (file.close() != 0)
+    {
+        throw transferError(_filename);
+    }
+    return true;
+}
+
+int Image::_imageModified() const
+{
+    if (_sidecarPath.empty())
+    {
+        return _state->modified;
+    }
+    return _state->modified & ~ImageState::xmp;
+}
+
+// The top-level property of an XMP key, without the path of an array item or
+// of a field of a structure.
+static std::string xmpProperty(const std::string& key)
+{
+    return key.substr(0, key.find_first_of("[/"));
+}
+
+void Image::_readXmpSidecar()
+{
+    if (!Exiv2::fileExists(_sidecarPath))
+    {
+        return;
+    }
+    Exiv2::Image::UniquePtr sidecar = Exiv2::ImageFactory::open(_sidecarPath);
+    sidecar->readMetadata();
+    const Exiv2::XmpData& sidecarData = sidecar->xmpData();
+    if (sidecarData.empty())
+    {
+        return;
+    }
+
+    // The properties of the sidecar replace the embedded ones as a whole,
+    // with all their array items and structure fields.
+    std::unordered_set<std::string> properties;
+    for (Exiv2::XmpData::const_iterator i = sidecarData.begin();
+         i != sidecarData.end();
+         ++i)
+    {
+        properties.insert(xmpProperty(i->key()));
+    }
+    Exiv2::XmpData& xmpData = _image->xmpData();
+    Exiv2::XmpData::iterator datum = xmpData.begin();
+    while (datum != xmpData.end())
+    {
+        if (properties.count(xmpProperty(datum->key())) != 0)
+        {
+            datum = xmpData.erase(datum);
+        }
+        else
+        {
+            ++datum;
+        }
+    }
+    for (Exiv2::XmpData::const_iterator i = sidecarData.begin();
+         i != sidecarData.end();
+         ++i)
+    {
+        xmpData.add(*i);
+    }
+}
+
+void Image::_writeXmpSidecar()
+{
+    Exiv2::Image::UniquePtr sidecar =
+        Exiv2::ImageFactory::create(Exiv2::ImageType::xmp);
+    sidecar->setXmpData(_image->xmpData());
+    sidecar->writeMetadata();
+
+    Exiv2::BasicIo& io = sidecar->io();
+    if (!Exiv2::fileExists(_sidecarPath))
+    {
+        Exiv2::FileIo file(_sidecarPath);
+        file.transfer(io);
+        return;
+    }
+    Exiv2::IoCloser closer(io);
+    io.open();
+    // A sidecar which can't be replaced is rewritten in place rather than
+    // failing the write of the image.
+    replaceFile(_sidecarPath, io.mmap(), io.size(), false, true);
+}
+
+void Image::setXmpSidecar(const std::string& path)
+{
+    ImageLock lock(_state);
+    if (_dataRead && _sidecarPath.empty())
+    {
+        // The XMP metadata read so far is the one embedded in the image.
+        _embeddedXmp = *_xmpData;
+    }
+    _sidecarPath = path;
+}
+
+Exiv2::Image::UniquePtr Image::_writeToMemory() const
+{
+    // The output image is opened on a memory stream referencing the data of
+    // the image, which is only copied by Exiv2 when rewriting it with the
+    // current metadata.
+    // The io is only closed if it is opened here: an io already open (e.g.
+    // by the caller) is left so.
+    Exiv2::BasicIo& io = _image->io();
+    const bool opened = !io.isopen();
+    if (opened)
+    {
+        io.open();
+    }
+    Exiv2::Image::UniquePtr output;
+    try
+    {
+        const Exiv2::byte* data = io.mmap();
+        output = Exiv2::ImageFactory::open(data, io.size());
+        output->setByteOrder(_image->byteOrder());
+        output->setMetadata(*_image);
+        output->writeXmpFromPacket(_image->writeXmpFromPacket());
+
+        std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+        output->writeMetadata();
+        io.munmap();
+    }
+    catch (...)
+    {
+        io.munmap();
+        if (opened)
+        {
+            io.close();
+        }
+        throw;
+    }
+    if (opened)
+    {
+        io.close();
+    }
+    return output;
+}
+
+bool Image::writeMetadataAtomic(bool preserveTimestamps)
+{
+    ImageLock lock(_state);
+    if (_data != 0 || _openIo)
+    {
+        // Nothing to replace for an image in memory or on a stream.
+        return writeMetadata();
+    }
+    _checkWritable();
+    if (_state->modified == 0)
+    {
+        return false;
     }
 
-    // Re-acquire the GIL
-    Py_END_ALLOW_THREADS
+    initialiseXmpToolkit();
 
-    if (error.code() != Exiv2::ErrorCode::kerSuccess)
-    {
-        throw error;
-    }
+    withoutGil([&] {
+        if (!_sidecarPath.empty() && (_state->modified & ImageState::xmp))
+        {
+            std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+            _writeXmpSidecar();
+        }
+        if (_imageModified() == 0)
+        {
+            return;
+        }
+        EmbeddedXmp embedded(_image->xmpData(), _embeddedXmp,
+                             !_sidecarPath.empty());
+        Exiv2::Image::UniquePtr output = _writeToMemory();
+        Exiv2::BasicIo& io = output->io();
+        Exiv2::IoCloser closer(io);
+        io.open();
+        // The file of the image must not be open (nor mapped) while replaced.
+        _image->io().close();
+        replaceFile(_filename, io.mmap(), io.size(), preserveTimestamps,
+                    false);
+    });
+    _state->modified = 0;
+    return true;
 }
 
-void Image::writeMetadata()
+py::object Image::writeMetadataTo(const std::string& path)
 {
-    CHECK_METADATA_READ
-
-    // If an exception is thrown, it has to be done outside of the
-    // Py_{BEGIN,END}_ALLOW_THREADS block.
-#ifdef HAVE_CLASS_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::ErrorCode::kerSuccess);
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-    Exiv2::Error error = Exiv2::Error(Exiv2::kerSuccess);
-#else
-    Exiv2::Error error(0);
-#endif
-#endif
+    ImageLock lock(_state);
+    _checkWritable();
 
-    // Release the GIL to allow other python threads to run
-    // while writing metadata.
-    Py_BEGIN_ALLOW_THREADS
+    initialiseXmpToolkit();
 
-    try
-    {
-        _image->writeMetadata();
-    }
+    Exiv2::Image::UniquePtr output;
+    withoutGil([&] {
+        output = _writeToMemory();
+        if (!path.empty())
+        {
+            Exiv2::FileIo file(path);
+            file.transfer(output->io());
+        }
+    });
 
-    catch (Exiv2::Error& err) 
+    if (!path.empty())
     {
-        //std::cout << "Caught Exiv2 exception '" << err.code() << "'\n";
-        error = err;
+        return py::none();
     }
 
-    // Re-acquire the GIL
-    Py_END_ALLOW_THREADS
-
-    if (error.code() != Exiv2::ErrorCode::kerSuccess)
+    // Allocate the bytes object once, and copy the data into it without the
+    // GIL.
+    Exiv2::BasicIo& io = output->io();
+    PyObject* buffer = PyBytes_FromStringAndSize(NULL, io.size());
+    if (buffer == NULL)
     {
-        throw error;
+        throw py::error_already_set();
     }
+    py::bytes data = py::reinterpret_steal<py::bytes>(buffer);
+    Exiv2::byte* dest = (Exiv2::byte*)PyBytes_AS_STRING(buffer);
+    withoutGil([&] {
+        Exiv2::IoCloser closer(io);
+        io.open();
+        std::memcpy(dest, io.mmap(), io.size());
+    });
+    return data;
 }
 
 unsigned int Image::pixelWidth() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
-    return _image->pixelWidth();
+    return _pixelWidth != 0 ? _pixelWidth : _image->pixelWidth();
 }
 
 unsigned int Image::pixelHeight() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
-    return _image->pixelHeight();
+    return _pixelHeight != 0 ? _pixelHeight : _image->pixelHeight();
 }
 
 std::string Image::mimeType() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
     return _image->mimeType();
 }
 
 py::list Image::exifKeys()
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
 
     py::list keys;
     for(Exiv2::ExifMetadata::iterator i = _exifData->begin();
@@ -282,11 +2873,14 @@ py::list Image::exifKeys()
 
 const ExifTag Image::getExifTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
 
     Exiv2::ExifKey exifKey = Exiv2::ExifKey(key);
+    const auto* datums = _exifIndex.find(*_exifData, exifKey.key());
 
-    if(_exifData->findKey(exifKey) == _exifData->end())
+    if(datums == 0)
 #ifdef HAVE_CLASS_ERROR_CODE
     {
         throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidKey, key);
@@ -303,16 +2897,43 @@ const ExifTag Image::getExifTag(std::string key)
 #endif
 #endif
 
-    return ExifTag(key, &(*_exifData)[key], _exifData, _image->byteOrder());
+    return ExifTag(key, &(*datums->front()), _exifData,
+                   _image->byteOrder(), _state);
+}
+
+bool Image::hasExifKey(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
+
+    return findKey<Exiv2::ExifKey>(_exifIndex, *_exifData, key) != 0;
+}
+
+py::object Image::tryGetExifTag(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
+
+    const auto* datums = findKey<Exiv2::ExifKey>(_exifIndex, *_exifData, key);
+    if (datums == 0)
+    {
+        return py::none();
+    }
+    return py::cast(ExifTag(key, &(*datums->front()), _exifData,
+                            _image->byteOrder(), _state));
 }
 
 void Image::deleteExifTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
 
     Exiv2::ExifKey exifKey = Exiv2::ExifKey(key);
-    Exiv2::ExifMetadata::iterator datum = _exifData->findKey(exifKey);
-    if(datum == _exifData->end())
+    const auto* datums = _exifIndex.find(*_exifData, exifKey.key());
+    if(datums == 0)
 #ifdef HAVE_CLASS_ERROR_CODE
     {
         throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidKey, key);
@@ -328,22 +2949,28 @@ void Image::deleteExifTag(std::string key)
     }
 #endif
 #endif
-    _exifData->erase(datum);
+    _exifData->erase(datums->front());
+    _exifIndex.remove(exifKey.key());
+    _state->modified |= ImageState::exif;
 }
 
 py::list Image::iptcKeys()
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
 
     py::list keys;
+    // A repeated tag is listed once, at its first occurrence.
+    std::unordered_set<std::string> seen;
     for(Exiv2::IptcMetadata::iterator i = _iptcData->begin();
         i != _iptcData->end();
         ++i)
     {
-        try {
-            keys.append(i->key());
-        } catch (py::error_already_set &) {
-            continue;
+        std::string key = i->key();
+        if (seen.insert(key).second)
+        {
+            keys.append(key);
         }
     }
     return keys;
@@ -351,11 +2978,15 @@ py::list Image::iptcKeys()
 
 const IptcTag Image::getIptcTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
 
     Exiv2::IptcKey iptcKey = Exiv2::IptcKey(key);
+    const auto* datums = _iptcIndex.find(*_iptcData, iptcKey.key(),
+                                        _state->iptcChanges);
 
-    if(_iptcData->findKey(iptcKey) == _iptcData->end())
+    if(datums == 0)
 #ifdef HAVE_CLASS_ERROR_CODE
     {
         throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidKey, key);
@@ -371,17 +3002,45 @@ const IptcTag Image::getIptcTag(std::string key)
     }
 #endif
 #endif
-    return IptcTag(key, _iptcData);
+    return IptcTag(key, _iptcData, datums->size(), _state);
+}
+
+bool Image::hasIptcKey(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
+
+    return findKey<Exiv2::IptcKey>(_iptcIndex, *_iptcData, key,
+                                   _state->iptcChanges) != 0;
+}
+
+py::object Image::tryGetIptcTag(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
+
+    const auto* datums = findKey<Exiv2::IptcKey>(_iptcIndex, *_iptcData, key,
+                                                 _state->iptcChanges);
+    if (datums == 0)
+    {
+        return py::none();
+    }
+    return py::cast(IptcTag(key, _iptcData, datums->size(), _state));
 }
 
 void Image::deleteIptcTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
 
     Exiv2::IptcKey iptcKey = Exiv2::IptcKey(key);
-    Exiv2::IptcMetadata::iterator dataIterator = _iptcData->findKey(iptcKey);
+    const auto* datums = _iptcIndex.find(*_iptcData, iptcKey.key(),
+                                        _state->iptcChanges);
 
-    if (dataIterator == _iptcData->end())
+    if (datums == 0)
 #ifdef HAVE_CLASS_ERROR_CODE
     {
         throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidKey, key);
@@ -398,22 +3057,16 @@ void Image::deleteIptcTag(std::string key)
 #endif
 #endif
 
-    while (dataIterator != _iptcData->end())
-    {
-        if (dataIterator->key() == key)
-        {
-            dataIterator = _iptcData->erase(dataIterator);
-        }
-        else
-        {
-            ++dataIterator;
-        }
-    }
+    _iptcIndex.invalidate();
+    eraseIptcValues(*_iptcData, iptcKey, 0);
+    _state->modified |= ImageState::iptc;
 }
 
 py::list Image::xmpKeys()
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
 
     py::list keys;
     for(Exiv2::XmpMetadata::iterator i = _xmpData->begin();
@@ -427,11 +3080,14 @@ py::list Image::xmpKeys()
 
 const XmpTag Image::getXmpTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
 
     Exiv2::XmpKey xmpKey = Exiv2::XmpKey(key);
+    const auto* datums = _xmpIndex.find(*_xmpData, xmpKey.key());
 
-    if(_xmpData->findKey(xmpKey) == _xmpData->end())
+    if(datums == 0)
 #ifdef HAVE_CLASS_ERROR_CODE
     {
         throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidKey, key);
@@ -448,18 +3104,45 @@ const XmpTag Image::getXmpTag(std::string key)
 #endif
 #endif
 
-    return XmpTag(key, &(*_xmpData)[key]);
+    return XmpTag(key, &(*datums->front()), _state);
+}
+
+bool Image::hasXmpKey(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
+
+    return findKey<Exiv2::XmpKey>(_xmpIndex, *_xmpData, key) != 0;
+}
+
+py::object Image::tryGetXmpTag(const std::string& key)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
+
+    const auto* datums = findKey<Exiv2::XmpKey>(_xmpIndex, *_xmpData, key);
+    if (datums == 0)
+    {
+        return py::none();
+    }
+    return py::cast(XmpTag(key, &(*datums->front()), _state));
 }
 
 void Image::deleteXmpTag(std::string key)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
 
     Exiv2::XmpKey xmpKey = Exiv2::XmpKey(key);
-    Exiv2::XmpMetadata::iterator i = _xmpData->findKey(xmpKey);
-    if(i != _xmpData->end())
+    const auto* datums = _xmpIndex.find(*_xmpData, xmpKey.key());
+    if(datums != 0)
     {
-        _xmpData->erase(i);
+        _xmpData->erase(datums->front());
+        _xmpIndex.invalidate();
+        _state->modified |= ImageState::xmp;
     }
     else
 #ifdef HAVE_CLASS_ERROR_CODE
@@ -479,44 +3162,181 @@ void Image::deleteXmpTag(std::string key)
 #endif
 }
 
+py::list Image::exifItems()
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
+
+    py::list items;
+    for(Exiv2::ExifMetadata::iterator i = _exifData->begin();
+        i != _exifData->end();
+        ++i)
+    {
+        std::string key = i->key();
+        const ExifTagInfo* info = exifTagInfo(i->ifdId(), i->tag(), key);
+        const char* type = exifTypeName(*i, info);
+        if (isExifBytesType(type))
+        {
+            items.append(py::make_tuple(key, type, exifBytesValue(*i)));
+        }
+        else
+        {
+            items.append(py::make_tuple(key, type, i->toString()));
+        }
+    }
+    return items;
+}
+
+py::list Image::iptcItems()
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
+
+    py::list items;
+    // The values of the repeated tags are gathered in the list of the first
+    // occurrence of their key.
+    std::unordered_map<std::string, py::list> values;
+    for(Exiv2::IptcMetadata::iterator i = _iptcData->begin();
+        i != _iptcData->end();
+        ++i)
+    {
+        std::string key = i->key();
+        auto found = values.find(key);
+        if (found == values.end())
+        {
+            py::list keyValues;
+            found = values.emplace(key, keyValues).first;
+            items.append(py::make_tuple(
+                key, iptcTagInfo(i->tag(), i->record())->type, keyValues));
+        }
+        found->second.append(i->toString());
+    }
+    return items;
+}
+
+py::list Image::xmpItems()
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
+
+    py::list items;
+    for(Exiv2::XmpMetadata::iterator i = _xmpData->begin();
+        i != _xmpData->end();
+        ++i)
+    {
+        std::string key = i->key();
+        const XmpTagInfo* info = xmpTagInfo(Exiv2::XmpKey(key));
+        items.append(py::make_tuple(key, info->type, xmpRawValue(i->value())));
+    }
+    return items;
+}
+
 const std::string Image::getComment() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
     return _image->comment();
 }
 
 void Image::setComment(const std::string& comment)
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
-    _image->setComment(comment);
+    if (comment != _image->comment())
+    {
+        _image->setComment(comment);
+        _state->modified |= ImageState::comment;
+    }
 }
 
 void Image::clearComment()
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
-    _image->clearComment();
+    if (!_image->comment().empty())
+    {
+        _image->clearComment();
+        _state->modified |= ImageState::comment;
+    }
+}
+
+py::tuple Image::modifiedFamilies() const
+{
+    ImageLock lock(_state);
+    py::list families;
+    if (_state->modified & ImageState::exif)
+    {
+        families.append("exif");
+    }
+    if (_state->modified & ImageState::iptc)
+    {
+        families.append("iptc");
+    }
+    if (_state->modified & ImageState::xmp)
+    {
+        families.append("xmp");
+    }
+    if (_state->modified & ImageState::comment)
+    {
+        families.append("comment");
+    }
+    return py::tuple(families);
 }
 
 
 py::list Image::previews()
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
 
+    // Only the properties of the previews are read here, the data of each
+    // preview is extracted on demand.
+    // Looking the previews up may scan the whole image, the python objects
+    // are built once the GIL is re-acquired.
+    Exiv2::PreviewPropertiesList props;
+    withoutGil([&] {
+        Exiv2::PreviewManager pm(*_image);
+        props = pm.getPreviewProperties();
+    });
+
+    py::object self = py::cast(this, py::return_value_policy::reference);
     py::list previews;
-    Exiv2::PreviewManager pm(*_image);
-    Exiv2::PreviewPropertiesList props = pm.getPreviewProperties();
     for (Exiv2::PreviewPropertiesList::const_iterator i = props.begin();
          i != props.end();
          ++i)
     {
-        previews.append(Preview(pm.getPreviewImage(*i)));
+        previews.append(Preview(self, *i));
     }
 
     return previews;
 }
 
+Exiv2::PreviewImage* Image::getPreviewImage(
+    const Exiv2::PreviewProperties& properties)
+{
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+
+    Exiv2::PreviewImage* previewImage = 0;
+
+    // Release the GIL to allow other python threads to run
+    // while extracting the preview.
+    withoutGil([&] {
+        Exiv2::PreviewManager pm(*_image);
+        previewImage = new Exiv2::PreviewImage(pm.getPreviewImage(properties));
+    });
+    return previewImage;
+}
+
 void Image::copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const
 {
+    // The locks of both images are always taken in the same order.
+    const bool first = _state.get() < other._state.get();
+    ImageLock lock(first ? _state : other._state);
+    ImageLock otherLock(first ? other._state : _state);
     CHECK_METADATA_READ
     if (!other._dataRead) 
     {
@@ -536,25 +3356,50 @@ void Image::copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const
 #endif
 #endif
     }
+    CHECK_FAMILY_READ(!exif || _exifRead, "Exif")
+    CHECK_FAMILY_READ(!iptc || _iptcRead, "Iptc")
+    CHECK_FAMILY_READ(!xmp || _xmpRead, "Xmp")
+
+    // Deep copy of the metadata.
+    withoutGil([&] {
+        if (exif)
+        {
+            other._image->setExifData(*_exifData);
+        }
+        if (iptc)
+        {
+            other._image->setIptcData(*_iptcData);
+        }
+        if (xmp)
+        {
+            other._image->setXmpData(*_xmpData);
+        }
+    });
 
     if (exif)
-        other._image->setExifData(*_exifData);
+    {
+        other._exifIndex.invalidate();
+        other._state->modified |= ImageState::exif;
+    }
     if (iptc)
-        other._image->setIptcData(*_iptcData);
+    {
+        other._iptcIndex.invalidate();
+        other._state->modified |= ImageState::iptc;
+    }
     if (xmp)
-        other._image->setXmpData(*_xmpData);
+    {
+        other._xmpIndex.invalidate();
+        other._state->modified |= ImageState::xmp;
+    }
 }
 
-py::bytes Image::getDataBuffer() const
+size_t Image::_readDataBuffer(Exiv2::byte* dest, size_t size) const
 {
-    std::string buffer;
-
-    // Release the GIL to allow other python threads to run
-    // while reading the image data.
-    Py_BEGIN_ALLOW_THREADS
-
+    if (_mapping)
+    {
+        _mapping->adviseSequential();
+    }
     Exiv2::BasicIo& io = _image->io();
-    unsigned long size = (unsigned long)io.size();
     long pos = -1;
 
     if (io.isopen())
@@ -569,18 +3414,8 @@ py::bytes Image::getDataBuffer() const
         io.open();
     }
 
-    // Copy the data buffer in a string. Since the data buffer can contain null
-    // characters ('\x00'), the string cannot be simply constructed like that:
-    //     buffer = std::string((char*) previewImage.pData());
-    // because it would be truncated after the first occurence of a null
-    // character. Therefore, it has to be copied character by character.
-    // First allocate the memory for the whole string...
-    buffer.resize(size, ' ');
-    // ... then fill it with the raw data.
-    for (unsigned long i = 0; i < size; ++i)
-    {
-        io.read((Exiv2::byte*) &buffer[i], 1);
-    }
+    // Bulk read of the whole stream (a memcpy for in-memory images).
+    size_t read = io.read(dest, size);
 
     if (pos == -1)
     {
@@ -592,15 +3427,115 @@ py::bytes Image::getDataBuffer() const
         // Reset to the initial position in the stream
         io.seek(pos, Exiv2::BasicIo::beg);
     }
+    return read;
+}
 
-    // Re-acquire the GIL
-    Py_END_ALLOW_THREADS
+py::bytes Image::getDataBuffer() const
+{
+    ImageLock lock(_state);
+    size_t size = _image->io().size();
 
-    return py::bytes(buffer.c_str(), buffer.size());
+    // Allocate the bytes object once, and let the stream fill it in place.
+    PyObject* buffer = PyBytes_FromStringAndSize(NULL, size);
+    if (buffer == NULL)
+    {
+        throw py::error_already_set();
+    }
+    py::bytes data = py::reinterpret_steal<py::bytes>(buffer);
+    Exiv2::byte* dest = (Exiv2::byte*)PyBytes_AS_STRING(buffer);
+    size_t read = 0;
+
+    // Release the GIL to allow other python threads to run
+    // while reading the image data.
+    withoutGil([&] {
+        read = _readDataBuffer(dest, size);
+    });
+    if (read != size)
+#ifdef HAVE_CLASS_ERROR_CODE
+    {
+        throw Exiv2::Error(Exiv2::ErrorCode::kerFailedToReadImageData);
+    }
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+    {
+        throw Exiv2::Error(Exiv2::kerFailedToReadImageData);
+    }
+#else
+    {
+        throw Exiv2::Error(14);
+    }
+#endif
+#endif
+
+    return data;
+}
+
+unsigned long Image::getDataSize() const
+{
+    ImageLock lock(_state);
+    return (unsigned long)_image->io().size();
+}
+
+py::object Image::getDataView() const
+{
+    ImageLock lock(_state);
+    if (!_mapping)
+    {
+        return py::none();
+    }
+    // The view holds a reference on the mapping, which outlives the image
+    // if needed.
+    py::object mapping = py::cast(_mapping);
+    PyObject* view = PyMemoryView_FromObject(mapping.ptr());
+    if (view == NULL)
+    {
+        throw py::error_already_set();
+    }
+    return py::reinterpret_steal<py::object>(view);
+}
+
+unsigned long Image::getDataBufferInto(py::buffer target) const
+{
+    ImageLock lock(_state);
+    py::buffer_info info = target.request(true);
+    size_t size = _image->io().size();
+    if ((size_t)contiguousSize(info) < size)
+    {
+        throw py::value_error("Target buffer is too small for the image data");
+    }
+    Exiv2::byte* dest = static_cast<Exiv2::byte*>(info.ptr);
+    size_t read = 0;
+
+    // Release the GIL to allow other python threads to run
+    // while reading the image data.
+    withoutGil([&] {
+        read = _readDataBuffer(dest, size);
+    });
+    return (unsigned long)read;
+}
+
+py::tuple Image::loadedFamilies() const
+{
+    ImageLock lock(_state);
+    py::list families;
+    if (_exifRead)
+    {
+        families.append("exif");
+    }
+    if (_iptcRead)
+    {
+        families.append("iptc");
+    }
+    if (_xmpRead)
+    {
+        families.append("xmp");
+    }
+    return py::tuple(families);
 }
 
 Exiv2::ByteOrder Image::getByteOrder() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
     return _image->byteOrder();
 }
@@ -608,6 +3543,7 @@ Exiv2::ByteOrder Image::getByteOrder() const
 Exiv2::ExifThumb* Image::_getExifThumbnail()
 {
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_exifRead, "Exif")
     if (_exifThumbnail == 0)
     {
         _exifThumbnail = new Exiv2::ExifThumb(*_exifData);
@@ -617,60 +3553,103 @@ Exiv2::ExifThumb* Image::_getExifThumbnail()
 
 const std::string Image::getExifThumbnailMimeType()
 {
+    ImageLock lock(_state);
     return std::string(_getExifThumbnail()->mimeType());
 }
 
 const std::string Image::getExifThumbnailExtension()
 {
+    ImageLock lock(_state);
     return std::string(_getExifThumbnail()->extension());
 }
 
 void Image::writeExifThumbnailToFile(const std::string& path)
 {
-    std::ignore = _getExifThumbnail()->writeFile(path);
+    ImageLock lock(_state);
+    Exiv2::ExifThumb* thumbnail = _getExifThumbnail();
+    withoutGil([&] {
+        std::ignore = thumbnail->writeFile(path);
+    });
 }
 
-py::list Image::getExifThumbnailData()
+py::bytes Image::getExifThumbnailData()
 {
-    Exiv2::DataBuf buffer = _getExifThumbnail()->copy();
-    // Copy the data buffer in a list.
-    py::list data;
+    ImageLock lock(_state);
+    Exiv2::ExifThumb* thumbnail = _getExifThumbnail();
+
+    Exiv2::DataBuf buffer;
+
+    // Release the GIL to allow other python threads to run
+    // while copying the thumbnail.
+    withoutGil([&] {
+        buffer = thumbnail->copy();
+    });
+
 #ifdef HAVE_CLASS_ERROR_CODE
-    for(unsigned int i = 0; i < buffer.size(); ++i) {
-        unsigned int datum = *buffer.data(i);
-        data.append(datum);
-    }
-    return data;
+    return py::bytes(buffer.c_str(), buffer.size());
 #else
     // libexiv2 < 0.28
-    for(unsigned int i = 0; i < buffer.size_; ++i)
-    {
-        unsigned int datum = buffer.pData_[i];
-        data.append(datum);
-    }
-    return data;
+    return py::bytes((const char*)buffer.pData_, buffer.size_);
 #endif
 }
 
 void Image::eraseExifThumbnail()
 {
-    _getExifThumbnail()->erase();
+    ImageLock lock(_state);
+    Exiv2::ExifThumb* thumbnail = _getExifThumbnail();
+    const long count = _exifData->count();
+    thumbnail->erase();
+    _exifIndex.invalidate();
+    if (_exifData->count() != count)
+    {
+        _state->modified |= ImageState::exif;
+    }
 }
 
 void Image::setExifThumbnailFromFile(const std::string& path)
 {
-    _getExifThumbnail()->setJpegThumbnail(path);
+    ImageLock lock(_state);
+    Exiv2::ExifThumb* thumbnail = _getExifThumbnail();
+    withoutGil([&] {
+        thumbnail->setJpegThumbnail(path);
+    });
+    _exifIndex.invalidate();
+    _state->modified |= ImageState::exif;
 }
 
-void Image::setExifThumbnailFromData(const std::string& data)
+void Image::setExifThumbnailFromData(py::buffer data)
 {
-    const Exiv2::byte* buffer = (const Exiv2::byte*) data.c_str();
-    _getExifThumbnail()->setJpegThumbnail(buffer, data.size());
+    ImageLock lock(_state);
+    Exiv2::ExifThumb* thumbnail = _getExifThumbnail();
+    py::buffer_info info = data.request();
+    py::ssize_t size = contiguousSize(info);
+    const Exiv2::byte* buffer = static_cast<const Exiv2::byte*>(info.ptr);
+
+    // Release the GIL to allow other python threads to run
+    // while copying the thumbnail, the view on the buffer keeps its memory
+    // pinned meanwhile.
+    try
+    {
+        withoutGil([&] {
+            thumbnail->setJpegThumbnail(buffer, size);
+        });
+    }
+
+    catch (...)
+    {
+        _exifIndex.invalidate();
+        throw;
+    }
+
+    _exifIndex.invalidate();
+    _state->modified |= ImageState::exif;
 }
 
 const std::string Image::getIptcCharset() const
 {
+    ImageLock lock(_state);
     CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_iptcRead, "Iptc")
     const char* charset = _iptcData->detectCharset();
     if (charset != 0)
     {
@@ -684,10 +3663,17 @@ const std::string Image::getIptcCharset() const
 
 const std::string Image::getXmpPacket(int format) const
 {
+    ImageLock lock(_state);
+    CHECK_METADATA_READ
+    CHECK_FAMILY_READ(_xmpRead, "Xmp")
   // Serialize the current XMP
     std::string xmpPacket;
     if (!_xmpData->empty() && !_image->writeXmpFromPacket()) {
-        Exiv2::XmpParser::encode(xmpPacket, _image->xmpData(), format);
+        initialiseXmpToolkit();
+        withoutGil([&] {
+            std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+            Exiv2::XmpParser::encode(xmpPacket, _image->xmpData(), format);
+        });
         }
   return xmpPacket;
 }
@@ -695,7 +3681,11 @@ const std::string Image::getXmpPacket(int format) const
 
 py::bytes Image::getICC() const
 {
-    Exiv2::DataBuf buffer = _image->iccProfile();
+    ImageLock lock(_state);
+    Exiv2::DataBuf buffer;
+    withoutGil([&] {
+        buffer = _image->iccProfile();
+    });
 
     return py::bytes((char*)buffer.c_str(), buffer.size());
 }
@@ -703,9 +3693,14 @@ py::bytes Image::getICC() const
 
 ExifTag::ExifTag(const std::string& key,
                  Exiv2::Exifdatum* datum, Exiv2::ExifData* data,
-                 Exiv2::ByteOrder byteOrder):
-    _key(key), _byteOrder(byteOrder)
+                 Exiv2::ByteOrder byteOrder, ImageStatePtr state):
+    _key(key), _byteOrder(byteOrder), _state(state)
 {
+    if (!_state)
+    {
+        _state = std::make_shared<ImageState>();
+    }
+
     if (datum != 0 && data != 0)
     {
         _datum = datum;
@@ -717,51 +3712,12 @@ ExifTag::ExifTag(const std::string& key,
         _data = 0;
     }
 
-// Conditional code, exiv2 0.21 changed APIs we need
-// (see https://bugs.launchpad.net/pyexiv2/+bug/684177).
-#if EXIV2_MAJOR_VERSION >= 1 || (EXIV2_MAJOR_VERSION == 0 && EXIV2_MINOR_VERSION >= 21)
-    Exiv2::ExifKey exifKey(key);
-    _type = Exiv2::TypeInfo::typeName(exifKey.defaultTypeId());
-    // Where available, extract the type from the metadata, it is more reliable
-    // than static type information. The exception is for user comments, for
-    // which we’d rather keep the 'Comment' type instead of 'Undefined'.
-    if ((_data != 0) && (_type != "Comment"))
+    _info = exifTagInfo(_key.ifdId(), _key.tag(), key);
+    _type = _info->defaultType.c_str();
+    if (_data != 0)
     {
-        const char* typeName = _datum->typeName();
-        if (typeName != 0)
-        {
-            _type = typeName;
-        }
-    }
-    _name = exifKey.tagName();
-    _label = exifKey.tagLabel();
-    _description = exifKey.tagDesc();
-    _sectionName = Exiv2::ExifTags::sectionName(exifKey);
-    // The section description is not exposed in the API any longer
-    // (see http://dev.exiv2.org/issues/744). For want of anything better,
-    // fall back on the section’s name.
-    _sectionDescription = _sectionName;
-#else
-    const uint16_t tag = _datum->tag();
-    const Exiv2::IfdId ifd = _datum->ifdId();
-    _type = Exiv2::TypeInfo::typeName(Exiv2::ExifTags::tagType(tag, ifd));
-    // Where available, extract the type from the metadata, it is more reliable
-    // than static type information. The exception is for user comments, for
-    // which we’d rather keep the 'Comment' type instead of 'Undefined'.
-    if ((_data != 0) && (_type != "Comment"))
-    {
-        const char* typeName = _datum->typeName();
-        if (typeName != 0)
-        {
-            _type = typeName;
-        }
+        _type = exifTypeName(*_datum, _info);
     }
-    _name = Exiv2::ExifTags::tagName(tag, ifd);
-    _label = Exiv2::ExifTags::tagLabel(tag, ifd);
-    _description = Exiv2::ExifTags::tagDesc(tag, ifd);
-    _sectionName = Exiv2::ExifTags::sectionName(tag, ifd);
-    _sectionDescription = Exiv2::ExifTags::sectionDesc(tag, ifd);
-#endif
 }
 
 ExifTag::~ExifTag()
@@ -774,6 +3730,8 @@ ExifTag::~ExifTag()
 
 void ExifTag::setRawValue(const std::string& value)
 {
+    ImageLock lock = lockTag(_state);
+    const std::string before = exifBytes(*_datum);
     int result = _datum->setValue(value);
     if (result != 0)
 #ifdef HAVE_CLASS_ERROR_CODE
@@ -795,10 +3753,36 @@ void ExifTag::setRawValue(const std::string& value)
     }
 #endif
 #endif
+    _markModified(before);
+}
+
+void ExifTag::setTypedValue(const py::list& items)
+{
+    ImageLock lock = lockTag(_state);
+    std::unique_ptr<Exiv2::Value> value =
+        exifValueFromItems(Exiv2::TypeInfo::typeId(_type), items);
+    if (!value)
+    {
+        std::string message("Value not settable natively for type ");
+        throw py::type_error(message + _type);
+    }
+    const std::string before = exifBytes(*_datum);
+    _datum->setValue(value.get());
+    _markModified(before);
+}
+
+void ExifTag::_markModified(const std::string& before)
+{
+    if (_data != 0 && exifBytes(*_datum) != before)
+    {
+        _state->modified |= ImageState::exif;
+    }
 }
 
 void ExifTag::setParentImage(Image& image)
 {
+    ImageLock lock = lockTag(_state);
+    ImageLock imageLock(image.getState());
     Exiv2::ExifData* data = image.getExifData();
     if (data == _data)
     {
@@ -808,6 +3792,9 @@ void ExifTag::setParentImage(Image& image)
         return;
     }
     _data = data;
+    Exiv2::ExifData::const_iterator existing = _data->findKey(_key);
+    const std::string before =
+        existing != _data->end() ? exifBytes(*existing) : std::string();
 
 #if EXIV2_MAJOR_VERSION >= 1 || (EXIV2_MAJOR_VERSION == 0 && EXIV2_MINOR_VERSION >= 28)
         Exiv2::Value::UniquePtr value = _datum->getValue();
@@ -819,6 +3806,8 @@ void ExifTag::setParentImage(Image& image)
     _datum->setValue(value.get());
 
     _byteOrder = image.getByteOrder();
+    std::atomic_store(&_state, image.getState());
+    _markModified(before);
 }
 
 const std::string ExifTag::getKey()
@@ -833,37 +3822,58 @@ const std::string ExifTag::getType()
 
 const std::string ExifTag::getName()
 {
-    return _name;
+    return _info->name;
 }
 
 const std::string ExifTag::getLabel()
 {
-    return _label;
+    std::call_once(_info->labelFlag,
+                   [this]() { _info->label = _key.tagLabel(); });
+    return _info->label;
 }
 
 const std::string ExifTag::getDescription()
 {
-    return _description;
+    std::call_once(_info->descriptionFlag,
+                   [this]() { _info->description = _key.tagDesc(); });
+    return _info->description;
 }
 
 const std::string ExifTag::getSectionName()
 {
-    return _sectionName;
+    return _info->sectionName;
 }
 
 const std::string ExifTag::getSectionDescription()
 {
-    return _sectionDescription;
+    return _info->sectionDescription;
 }
 
 const std::string ExifTag::getRawValue()
 {
+    ImageLock lock = lockTag(_state);
     return _datum->toString();
 }
 
 const std::string ExifTag::getHumanValue()
 {
-    return _datum->print(_data);
+    ImageLock lock = lockTag(_state);
+    // Printing a makernote tag may decode a whole makernote structure.
+    std::string value;
+    withoutGil([&] {
+        value = _datum->print(_data);
+    });
+    return value;
+}
+
+py::object ExifTag::getTypedValue()
+{
+    ImageLock lock = lockTag(_state);
+    if (isExifBytesType(_type))
+    {
+        return exifBytesValue(*_datum);
+    }
+    return exifTypedValue(*_datum);
 }
 
 int ExifTag::getByteOrder()
@@ -872,8 +3882,14 @@ int ExifTag::getByteOrder()
 }
 
 
-IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data): _key(key)
+IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data,
+                 size_t nbValues, ImageStatePtr state): _key(key), _state(state)
 {
+    if (!_state)
+    {
+        _state = std::make_shared<ImageState>();
+    }
+
     _from_data = (data != 0);
 
     if (_from_data)
@@ -886,53 +3902,30 @@ IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data): _key(key)
         _data->add(Exiv2::Iptcdatum(_key));
     }
 
-    Exiv2::IptcMetadata::iterator iterator = _data->findKey(_key);
-    const uint16_t tag = iterator->tag();
-    const uint16_t record = iterator->record();
-    _type = Exiv2::TypeInfo::typeName(Exiv2::IptcDataSets::dataSetType(tag, record));
-    _name = Exiv2::IptcDataSets::dataSetName(tag, record);
-    _title = Exiv2::IptcDataSets::dataSetTitle(tag, record);
-    _description = Exiv2::IptcDataSets::dataSetDesc(tag, record);
-    // What is the photoshop name anyway? Where is it used?
-    _photoshopName = Exiv2::IptcDataSets::dataSetPsName(tag, record);
-    _repeatable = Exiv2::IptcDataSets::dataSetRepeatable(tag, record);
-    _recordName = Exiv2::IptcDataSets::recordName(record);
-    _recordDescription = Exiv2::IptcDataSets::recordDesc(record);
+    _info = iptcTagInfo(_key.tag(), _key.record());
 
-    if (_from_data)
-    {
-        // Check that we are not trying to assign multiple values to a tag that
-        // is not repeatable.
-        unsigned int nb_values = 0;
-        for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
-            iterator != _data->end(); ++iterator)
-        {
-            if (iterator->key() == key)
-            {
-                ++nb_values;
-                if (!_repeatable && (nb_values > 1))
+    // Check that we are not trying to assign multiple values to a tag that
+    // is not repeatable.
+    if (_from_data && !_info->repeatable && (nbValues > 1))
 #ifdef HAVE_CLASS_ERROR_CODE
-                {
-                    std::string mssg("Tag not repeatable: ");
-                    mssg += key;
-                    throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, mssg);
-                }
+    {
+        std::string mssg("Tag not repeatable: ");
+        mssg += key;
+        throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, mssg);
+    }
 #else 
 #ifdef HAVE_EXIV2_ERROR_CODE
-                {
-                    std::string mssg("Tag not repeatable: ");
-                    mssg += key;
-                    throw Exiv2::Error(Exiv2::kerErrorMessage, mssg);
-                }
+    {
+        std::string mssg("Tag not repeatable: ");
+        mssg += key;
+        throw Exiv2::Error(Exiv2::kerErrorMessage, mssg);
+    }
 #else
-                {
-                    throw Exiv2::Error(NON_REPEATABLE);
-                }
+    {
+        throw Exiv2::Error(NON_REPEATABLE);
+    }
 #endif
 #endif
-            }
-        }
-    }
 }
 
 IptcTag::~IptcTag()
@@ -945,7 +3938,71 @@ IptcTag::~IptcTag()
 
 void IptcTag::setRawValues(const py::list& values)
 {
-    if (!_repeatable && (py::len(values) > 1))
+    ImageLock lock = lockTag(_state);
+    _checkRepeatable(py::len(values));
+
+    Exiv2::TypeId type = Exiv2::IptcDataSets::dataSetType(_key.tag(),
+                                                          _key.record());
+    std::vector<std::unique_ptr<Exiv2::Value> > parsed;
+    for (auto item : values)
+    {
+        const std::string value = item.cast<std::string>();
+        std::unique_ptr<Exiv2::Value> datumValue(
+            Exiv2::Value::create(type).release());
+        int result = datumValue->read(value);
+        if (result != 0)
+#ifdef HAVE_CLASS_ERROR_CODE
+        {
+            std::string mssg("Invalid value: ");
+            mssg += value;
+            // there's no invalid value error in libexiv2, so we use 
+            // kerInvalidDataset wich raise a Python ValueError
+            throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidDataset, mssg);
+        }
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+        {
+            std::string mssg("Invalid value: ");
+            mssg += value;
+            // there's no invalid value error in libexiv2, so we use 
+            // kerInvalidDataset wich raise a Python ValueError
+            throw Exiv2::Error(Exiv2::kerInvalidDataset, mssg);
+        }
+#else
+        {
+            throw Exiv2::Error(INVALID_VALUE);
+        }
+#endif
+#endif
+        parsed.push_back(std::move(datumValue));
+    }
+    _setValues(parsed);
+}
+
+void IptcTag::setTypedValues(const py::list& values)
+{
+    ImageLock lock = lockTag(_state);
+    _checkRepeatable(py::len(values));
+
+    Exiv2::TypeId type = Exiv2::IptcDataSets::dataSetType(_key.tag(),
+                                                          _key.record());
+    std::vector<std::unique_ptr<Exiv2::Value> > built;
+    for (auto item : values)
+    {
+        std::unique_ptr<Exiv2::Value> value = iptcValueFromItem(type, item);
+        if (!value)
+        {
+            throw py::type_error("Values not settable natively for type " +
+                                 _info->type);
+        }
+        built.push_back(std::move(value));
+    }
+    _setValues(built);
+}
+
+void IptcTag::_checkRepeatable(size_t nbValues)
+{
+    if (!_info->repeatable && (nbValues > 1))
     {
         // The tag is not repeatable but we are trying to assign it more than
         // one value.
@@ -965,114 +4022,78 @@ void IptcTag::setRawValues(const py::list& values)
 #endif
 #endif
     }
+}
+
+void IptcTag::_setValues(
+    const std::vector<std::unique_ptr<Exiv2::Value> >& values)
+{
+    const std::string before = _from_data ? iptcBytes(*_data, _key)
+                                          : std::string();
+    _overrideValues(values);
+    if (_from_data && iptcBytes(*_data, _key) != before)
+    {
+        _state->modified |= ImageState::iptc;
+    }
+}
 
-    unsigned int index = 0;
-    size_t max = py::len(values);
-    Exiv2::IptcMetadata::iterator iterator = _data->findKey(_key);
-    while (index < max)
+void IptcTag::_overrideValues(
+    const std::vector<std::unique_ptr<Exiv2::Value> >& values)
+{
+    // Override the existing values in a single pass
+    size_t index = 0;
+    for (Exiv2::IptcMetadata::iterator iterator = _data->begin();
+         (iterator != _data->end()) && (index < values.size()); ++iterator)
     {
-        std::string value = values[index++].cast<std::string>();
-        if (iterator != _data->end())
+        if (hasIptcKey(*iterator, _key))
         {
-            // Override an existing value
-            int result = iterator->setValue(value);
-            if (result != 0)
-#ifdef HAVE_CLASS_ERROR_CODE
-            {
-                std::string mssg("Invalid value: ");
-                mssg += value;
-                // there's no invalid value error in libexiv2, so we use 
-                // kerInvalidDataset wich raise a Python ValueError
-                throw Exiv2::Error(Exiv2::ErrorCode::kerInvalidDataset, mssg);
-            }
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-            {
-                std::string mssg("Invalid value: ");
-                mssg += value;
-                // there's no invalid value error in libexiv2, so we use 
-                // kerInvalidDataset wich raise a Python ValueError
-                throw Exiv2::Error(Exiv2::kerInvalidDataset, mssg);
-            }
-#else
-            {
-                throw Exiv2::Error(INVALID_VALUE);
-            }
-#endif
-#endif
-            // Jump to the next datum matching the key
-            ++iterator;
-            while ((iterator != _data->end()) && (iterator->key() != _key.key()))
-            {
-                ++iterator;
-            }
+            iterator->setValue(values[index++].get());
         }
-        else
+    }
+
+    if (index == values.size())
+    {
+        // Erase the remaining values if any
+        const long count = _data->count();
+        eraseIptcValues(*_data, _key, values.size());
+        if (_data->count() != count)
         {
-            // Append a new value
-            Exiv2::Iptcdatum datum(_key);
-            int result = datum.setValue(value);
-            if (result != 0)
-#ifdef HAVE_CLASS_ERROR_CODE
-            {
-                std::string mssg("Invalid value: ");
-                mssg += value;
-                throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, mssg);
-            }
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-            {
-                std::string mssg("Invalid value: ");
-                mssg += value;
-                throw Exiv2::Error(Exiv2::kerErrorMessage, mssg);
-            }
-#else
-            {
-                throw Exiv2::Error(INVALID_VALUE);
-            }
-#endif
-#endif
-            int state = _data->add(datum);
-            if (state == 6)
-#ifdef HAVE_CLASS_ERROR_CODE
-            {
-                std::string mssg("Tag not repeatable: ");
-                mssg += _key.key();
-                throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, mssg);
-            }
-#else 
-#ifdef HAVE_EXIV2_ERROR_CODE
-            {
-                std::string mssg("Tag not repeatable: ");
-                mssg += _key.key();
-                throw Exiv2::Error(Exiv2::kerErrorMessage, mssg);
-            }
-#else
-            {
-                throw Exiv2::Error(NON_REPEATABLE);
-            }
-#endif
-#endif
-            // Reset iterator that has been invalidated by appending a datum
-            iterator = _data->end();
+            ++_state->iptcChanges;
         }
+        return;
     }
-    // Erase the remaining values if any
-    while (iterator != _data->end())
+
+    // Append the new values
+    ++_state->iptcChanges;
+    for (; index < values.size(); ++index)
     {
-        if (iterator->key() == _key.key())
+        int state = _data->add(Exiv2::Iptcdatum(_key, values[index].get()));
+        if (state == 6)
+#ifdef HAVE_CLASS_ERROR_CODE
         {
-            iterator = _data->erase(iterator);
+            std::string mssg("Tag not repeatable: ");
+            mssg += _key.key();
+            throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, mssg);
         }
-        else
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+        {
+            std::string mssg("Tag not repeatable: ");
+            mssg += _key.key();
+            throw Exiv2::Error(Exiv2::kerErrorMessage, mssg);
+        }
+#else
         {
-            ++iterator;
+            throw Exiv2::Error(NON_REPEATABLE);
         }
+#endif
+#endif
     }
 }
 
 void IptcTag::setParentImage(Image& image)
 {
+    ImageLock lock = lockTag(_state);
+    ImageLock imageLock(image.getState());
     Exiv2::IptcData* data = image.getIptcData();
     if (data == _data)
     {
@@ -1085,6 +4106,8 @@ void IptcTag::setParentImage(Image& image)
     delete _data;
     _from_data = true;
     _data = data;
+    // The values are set under the state of the image.
+    std::atomic_store(&_state, image.getState());
     setRawValues(values);
 }
 
@@ -1095,51 +4118,62 @@ const std::string IptcTag::getKey()
 
 const std::string IptcTag::getType()
 {
-    return _type;
+    return _info->type;
 }
 
 const std::string IptcTag::getName()
 {
-    return _name;
+    return _info->name;
 }
 
 const std::string IptcTag::getTitle()
 {
-    return _title;
+    std::call_once(_info->titleFlag, [this]()
+    {
+        _info->title = Exiv2::IptcDataSets::dataSetTitle(_key.tag(),
+                                                         _key.record());
+    });
+    return _info->title;
 }
 
 const std::string IptcTag::getDescription()
 {
-    return _description;
+    std::call_once(_info->descriptionFlag, [this]()
+    {
+        _info->description = Exiv2::IptcDataSets::dataSetDesc(_key.tag(),
+                                                              _key.record());
+    });
+    return _info->description;
 }
 
 const std::string IptcTag::getPhotoshopName()
 {
-    return _photoshopName;
+    return _info->photoshopName;
 }
 
 const bool IptcTag::isRepeatable()
 {
-    return _repeatable;
+    return _info->repeatable;
 }
 
 const std::string IptcTag::getRecordName()
 {
-    return _recordName;
+    return _info->recordName;
 }
 
 const std::string IptcTag::getRecordDescription()
 {
-    return _recordDescription;
+    return _info->recordDescription;
 }
 
 const py::list IptcTag::getRawValues()
 {
+    ImageLock lock = lockTag(_state);
     py::list values;
     for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
         iterator != _data->end(); ++iterator)
     {
-        if (iterator->key() == _key.key())
+        if (hasIptcKey(*iterator, _key))
         {
             values.append(iterator->toString());
         }
@@ -1148,9 +4182,32 @@ const py::list IptcTag::getRawValues()
 }
 
 
-XmpTag::XmpTag(const std::string& key, Exiv2::Xmpdatum* datum): _key(key)
+const py::list IptcTag::getTypedValues()
+{
+    ImageLock lock = lockTag(_state);
+    py::list values;
+    for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
+        iterator != _data->end(); ++iterator)
+    {
+        if (hasIptcKey(*iterator, _key))
+        {
+            values.append(iptcTypedValue(*iterator));
+        }
+    }
+    return values;
+}
+
+
+XmpTag::XmpTag(const std::string& key, Exiv2::Xmpdatum* datum,
+               ImageStatePtr state): _key(key), _state(state)
 {
+    if (!_state)
+    {
+        _state = std::make_shared<ImageState>();
+    }
+
     _from_datum = (datum != 0);
+    _info = xmpTagInfo(_key);
 
     if (_from_datum)
     {
@@ -1160,26 +4217,7 @@ XmpTag::XmpTag(const std::string& key, Exiv2::Xmpdatum* datum): _key(key)
     else
     {
         _datum = new Exiv2::Xmpdatum(_key);
-        _exiv2_type = Exiv2::TypeInfo::typeName(Exiv2::XmpProperties::propertyType(_key));
-    }
-
-    const char* title = Exiv2::XmpProperties::propertyTitle(_key);
-    if (title != 0)
-    {
-        _title = title;
-    }
-
-    const char* description = Exiv2::XmpProperties::propertyDesc(_key);
-    if (description != 0)
-    {
-        _description = description;
-    }
-
-    const Exiv2::XmpPropertyInfo* info = Exiv2::XmpProperties::propertyInfo(_key);
-    if (info != 0)
-    {
-        _name = info->name_;
-        _type = info->xmpValueType_;
+        _exiv2_type = _info->defaultExiv2Type.c_str();
     }
 }
 
@@ -1193,21 +4231,46 @@ XmpTag::~XmpTag()
 
 void XmpTag::setTextValue(const std::string& value)
 {
+    ImageLock lock = lockTag(_state);
+    const std::string before = xmpBytes(*_datum);
     _datum->setValue(value);
+    _markModified(before);
 }
 
 void XmpTag::setArrayValue(const py::list& values)
 {
-    // Reset the value
-    _datum->setValue(0);
+    ImageLock lock = lockTag(_state);
+    const std::string before = xmpBytes(*_datum);
+    Exiv2::TypeId type = Exiv2::XmpProperties::propertyType(_key);
+    if ((type != Exiv2::xmpAlt && type != Exiv2::xmpBag &&
+         type != Exiv2::xmpSeq) || py::len(values) == 0)
+    {
+        // Reset the value
+        _datum->setValue(0);
 
-    for (auto value : values) {
-        _datum->setValue(std::string(py::str(value)));
+        for (auto value : values) {
+            _datum->setValue(std::string(py::str(value)));
+        }
+    }
+    else
+    {
+        // Build the whole array at once, instead of appending the items to
+        // the value of the datum one by one.
+        Exiv2::XmpArrayValue value(type);
+        for (auto item : values)
+        {
+            value.read(PyUnicode_Check(item.ptr()) ? item.cast<std::string>()
+                                                   : std::string(py::str(item)));
+        }
+        _datum->setValue(&value);
     }
+    _markModified(before);
 }
 
 void XmpTag::setLangAltValue(const py::dict& values)
 {
+    ImageLock lock = lockTag(_state);
+    const std::string before = xmpBytes(*_datum);
     // Reset the value
     _datum->setValue(0);
 
@@ -1216,11 +4279,26 @@ void XmpTag::setLangAltValue(const py::dict& values)
         auto value = item.second.cast<std::string>();
         _datum->setValue("lang=\"" + key + "\" " + value);
     }
+    _markModified(before);
+}
+
+void XmpTag::_markModified(const std::string& before)
+{
+    if (_from_datum && xmpBytes(*_datum) != before)
+    {
+        _state->modified |= ImageState::xmp;
+    }
 }
 
 void XmpTag::setParentImage(Image& image)
 {
-    Exiv2::Xmpdatum* datum = &(*image.getXmpData())[_key.key()];
+    ImageLock lock = lockTag(_state);
+    ImageLock imageLock(image.getState());
+    Exiv2::XmpData* data = image.getXmpData();
+    Exiv2::XmpData::const_iterator existing = data->findKey(_key);
+    const std::string before =
+        existing != data->end() ? xmpBytes(*existing) : std::string();
+    Exiv2::Xmpdatum* datum = &(*data)[_key.key()];
     if (datum == _datum)
     {
         // The parent image is already the one passed as a parameter.
@@ -1236,8 +4314,10 @@ void XmpTag::setParentImage(Image& image)
 #endif
     delete _datum;
     _from_datum = true;
-    _datum = &(*image.getXmpData())[_key.key()];
+    _datum = datum;
     _datum->setValue(value.get());
+    std::atomic_store(&_state, image.getState());
+    _markModified(before);
 }
 
 const std::string XmpTag::getKey()
@@ -1252,104 +4332,106 @@ const std::string XmpTag::getExiv2Type()
 
 const std::string XmpTag::getType()
 {
-    return _type;
+    return _info->type;
 }
 
 const std::string XmpTag::getName()
 {
-    return _name;
+    return _info->name;
 }
 
 const std::string XmpTag::getTitle()
 {
-    return _title;
+    std::call_once(_info->titleFlag, [this]()
+    {
+        const char* title = Exiv2::XmpProperties::propertyTitle(_key);
+        if (title != 0)
+        {
+            _info->title = title;
+        }
+    });
+    return _info->title;
 }
 
 const std::string XmpTag::getDescription()
 {
-    return _description;
+    std::call_once(_info->descriptionFlag, [this]()
+    {
+        const char* description = Exiv2::XmpProperties::propertyDesc(_key);
+        if (description != 0)
+        {
+            _info->description = description;
+        }
+    });
+    return _info->description;
 }
 
 const std::string XmpTag::getTextValue()
 {
+    ImageLock lock = lockTag(_state);
     return dynamic_cast<const Exiv2::XmpTextValue*>(&_datum->value())->value_;
 }
 
 const py::list XmpTag::getArrayValue()
 {
-#ifdef HAVE_OLD_ERROR_CODE
-    std::vector<std::string> value =
-        dynamic_cast<const Exiv2::XmpArrayValue*>(&_datum->value())->value_;
-    py::list rvalue;
-    for(std::vector<std::string>::const_iterator i = value.begin();
-        i != value.end(); ++i)
-    {
-        rvalue.append(*i);
-    }
-    return rvalue;
-#else
-    // We can't use &_datum->value())->value_ because value_ is private in
-    // this context (change in libexiv2 0.27)
-    const Exiv2::XmpArrayValue* xav = 
-            dynamic_cast<const Exiv2::XmpArrayValue*>(&_datum->value());
-    py::list rvalue;
-    for(size_t i = 0; i < xav->count(); ++i)
-    {
-        std::string value = xav->toString(i);
-        rvalue.append(value);
-    }
-    return rvalue;
-#endif
+    ImageLock lock = lockTag(_state);
+    return xmpArrayValue(_datum->value());
 }
 
 const py::dict XmpTag::getLangAltValue()
 {
-    Exiv2::LangAltValue::ValueType value =
-        dynamic_cast<const Exiv2::LangAltValue*>(&_datum->value())->value_;
-    py::dict rvalue;
-    for (Exiv2::LangAltValue::ValueType::const_iterator i = value.begin();
-         i != value.end(); ++i)
-    {
-        rvalue[i->first.c_str()] = i->second;
-    }
-    return rvalue;
+    ImageLock lock = lockTag(_state);
+    return xmpLangAltValue(_datum->value());
 }
 
 
-Preview::Preview(const Exiv2::PreviewImage& previewImage)
+Preview::Preview(py::object image,
+                 const Exiv2::PreviewProperties& properties):
+    _image(image), _properties(properties)
 {
-    _mimeType = previewImage.mimeType();
-    _extension = previewImage.extension();
-    _size = previewImage.size();
-    _dimensions = py::make_tuple(previewImage.width(),
-                                            previewImage.height());
+    _mimeType = properties.mimeType_;
+    _extension = properties.extension_;
+    _size = properties.size_;
+    _dimensions = py::make_tuple(properties.width_, properties.height_);
+}
 
-    // Copy the data buffer in a string. Since the data buffer can contain null
-    // characters ('\x00'), the string cannot be simply constructed like that:
-    //     _data = std::string((char*) previewImage.pData());
-    // because it would be truncated after the first occurence of a null
-    // character. Therefore, it has to be copied character by character.
-    const Exiv2::byte* pData = previewImage.pData();
-    // First allocate the memory for the whole string...
-    _data = std::string(_size, ' ');
-    // ... then fill it with the raw data.
-    for(unsigned int i = 0; i < _size; ++i)
+const Exiv2::PreviewImage& Preview::_fetch()
+{
+    // The preview is extracted once, under the lock of its image.
+    Image& image = _image.cast<Image&>();
+    ImageLock lock(image.getState());
+    if (!_previewImage)
     {
-        _data[i] = pData[i];
+        _previewImage.reset(image.getPreviewImage(_properties));
     }
+    return *_previewImage;
+}
+
+py::object Preview::getData()
+{
+    const Exiv2::PreviewImage& previewImage = _fetch();
+    return py::bytes((const char*)previewImage.pData(), previewImage.size());
 }
 
-py::object Preview::getData() const
+py::buffer_info Preview::getBuffer()
 {
-    return py::bytes((char*)_data.c_str(), _size);
+    const Exiv2::PreviewImage& previewImage = _fetch();
+    return py::buffer_info(const_cast<Exiv2::byte*>(previewImage.pData()),
+                           sizeof(Exiv2::byte),
+                           py::format_descriptor<Exiv2::byte>::format(),
+                           1, {(py::ssize_t)previewImage.size()},
+                           {(py::ssize_t)sizeof(Exiv2::byte)}, true);
 }
 
-void Preview::writeToFile(const std::string& path) const
+void Preview::writeToFile(const std::string& path)
 {
+    const Exiv2::PreviewImage& previewImage = _fetch();
     std::string filename = path + _extension;
-    std::ofstream fd(filename.c_str(), std::ios::out | std::ios::binary);
-    fd << _data;
-    fd.close();
+    withoutGil([&] {
+        std::ofstream fd(filename.c_str(), std::ios::out | std::ios::binary);
+        fd.write((const char*)previewImage.pData(), previewImage.size());
+        fd.close();
+    });
 }
 
 
@@ -1987,9 +5069,149 @@ void translateExiv2Error(Exiv2::Error const& error)
 }
 #endif
 
+py::object openStream(py::object stream, size_t bufferSize)
+{
+    Image* image = new Image([stream, bufferSize]() -> Exiv2::BasicIo* {
+        return new PythonIo(stream, bufferSize);
+    });
+    return py::cast(image, py::return_value_policy::take_ownership);
+}
+
+py::object openRange(py::object fetch, size_t size, size_t blockSize,
+                     size_t cacheBlocks, size_t readahead)
+{
+    Image* image = new Image([=]() -> Exiv2::BasicIo* {
+        return new RangeIo(fetch, size, blockSize, cacheBlocks, readahead);
+    });
+    return py::cast(image, py::return_value_policy::take_ownership);
+}
+
+py::list readMany(const py::list& paths, unsigned int threads)
+{
+    const size_t count = py::len(paths);
+    std::vector<std::string> filenames;
+    filenames.reserve(count);
+    for (auto path : paths)
+    {
+        filenames.push_back(path.cast<std::string>());
+    }
+
+#ifdef HAVE_CLASS_ERROR_CODE
+    Exiv2::Error success = Exiv2::Error(Exiv2::ErrorCode::kerSuccess);
+#else 
+#ifdef HAVE_EXIV2_ERROR_CODE
+    Exiv2::Error success = Exiv2::Error(Exiv2::kerSuccess);
+#else
+    Exiv2::Error success(0);
+#endif
+#endif
+    std::vector<Exiv2::Image::UniquePtr> images(count);
+    std::vector<Exiv2::Error> errors(count, success);
+    // Messages of the non Exiv2 exceptions (e.g. std::bad_alloc)
+    std::vector<std::string> failures(count);
+
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads > count)
+    {
+        threads = (unsigned int)count;
+    }
+
+    // The XMP toolkit must be initialised before being used from several
+    // threads.
+    initialiseXmpToolkit();
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                std::shared_lock<std::shared_mutex> lock(xmpNsMutex);
+                Exiv2::Image::UniquePtr image =
+                    Exiv2::ImageFactory::open(filenames[i]);
+                image->readMetadata();
+                images[i] = std::move(image);
+            }
+            catch (Exiv2::Error& err)
+            {
+                errors[i] = err;
+            }
+            catch (std::exception& err)
+            {
+                failures[i] = err.what();
+                if (failures[i].empty())
+                {
+                    failures[i] = "Unknown error";
+                }
+            }
+        }
+    };
+
+    // Release the GIL to allow other python threads to run
+    // while reading the whole batch.
+    withoutGil([&] {
+        std::vector<std::thread> pool;
+        try
+        {
+            for (unsigned int i = 1; i < threads; ++i)
+            {
+                pool.emplace_back(worker);
+            }
+            // The calling thread takes its share of the work.
+            worker();
+        }
+        catch (...)
+        {
+            // A thread couldn't be started: the threads already started
+            // must be joined before leaving, destroying a joinable thread
+            // terminates the process.
+            for (auto& thread : pool)
+            {
+                thread.join();
+            }
+            throw;
+        }
+        for (auto& thread : pool)
+        {
+            thread.join();
+        }
+    });
+
+    py::list results;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (images[i])
+        {
+            results.append(py::cast(new Image(filenames[i], std::move(images[i])),
+                                    py::return_value_policy::take_ownership));
+        }
+        else if (!failures[i].empty())
+        {
+            py::object runtimeError =
+                py::reinterpret_borrow<py::object>(PyExc_RuntimeError);
+            results.append(runtimeError(failures[i]));
+        }
+        else
+        {
+            // Let the usual translation build the Python exception, then
+            // take it back from the interpreter.
+            translateExiv2Error(errors[i]);
+            py::error_already_set pyError;
+            results.append(pyError.value());
+        }
+    }
+    return results;
+}
+
+
 bool initialiseXmpParser()
 {
-    if (!Exiv2::XmpParser::initialize())
+    std::unique_lock<std::shared_mutex> lock = lockXmpNamespaces();
+    if (!initialiseXmpToolkit())
         return false;
 
     std::string prefix("py3exiv2");
@@ -2012,6 +5234,7 @@ bool initialiseXmpParser()
 
 bool closeXmpParser()
 {
+    std::unique_lock<std::shared_mutex> lock = lockXmpNamespaces();
     std::string name("www.py3exiv2.tuxfamily.org/");
     const std::string& prefix = Exiv2::XmpProperties::prefix(name);
     if (prefix != "")
@@ -2026,6 +5249,7 @@ bool closeXmpParser()
 
 void registerXmpNs(const std::string& name, const std::string& prefix)
 {
+    std::unique_lock<std::shared_mutex> lock = lockXmpNamespaces();
     try
     {
         const std::string& ns = Exiv2::XmpProperties::ns(prefix);
@@ -2061,6 +5285,7 @@ void registerXmpNs(const std::string& name, const std::string& prefix)
 
 void unregisterXmpNs(const std::string& name)
 {
+    std::unique_lock<std::shared_mutex> lock = lockXmpNamespaces();
     const std::string& prefix = Exiv2::XmpProperties::prefix(name);
     if (prefix != "")
     {
@@ -2119,34 +5344,66 @@ void unregisterXmpNs(const std::string& name)
 
 void unregisterAllXmpNs()
 {
+    std::unique_lock<std::shared_mutex> lock = lockXmpNamespaces();
     // Unregister all custom namespaces.
     Exiv2::XmpProperties::unregisterNs();
 }
 
 
+// Exiv2 may log from several threads at once (see readMany), and reads its
+// log level there without any lock. Its level stays mute until initLog is
+// called, so that no message is even formatted meanwhile, and then follows
+// the level set by setLogLevel: neither function may thus be called while
+// images are read or written from other threads. The messages are written
+// one at a time.
+static std::atomic<int> logLevel(Exiv2::LogMsg::warn);
+static std::atomic<bool> logEnabled(false);
+static std::mutex logMutex;
+
 void logHandler(int level, const char *msg)
 {
+    if (!logEnabled || level < logLevel)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(logMutex);
     std::cout << "EVIV2LOG: " << msg << std::endl;
 }
 
+// Set the level of Exiv2 from the state of the log.
+static void updateLogLevel()
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    Exiv2::LogMsg::setLevel(logEnabled ?
+        static_cast<Exiv2::LogMsg::Level>(logLevel.load()) :
+        Exiv2::LogMsg::mute);
+}
 
-void initLog()
+void setupLog()
 {
     Exiv2::LogMsg::setHandler(logHandler);
+    updateLogLevel();
+}
+
+void initLog()
+{
+    logEnabled = true;
+    updateLogLevel();
 }
 
 void setLogLevel(int level)
 {
     if (level == 0)
-        Exiv2::LogMsg::setLevel(Exiv2::LogMsg::debug);
+        logLevel = Exiv2::LogMsg::debug;
     if (level == 1)
-        Exiv2::LogMsg::setLevel(Exiv2::LogMsg::info);
+        logLevel = Exiv2::LogMsg::info;
     if (level == 2)
-        Exiv2::LogMsg::setLevel(Exiv2::LogMsg::warn);
+        logLevel = Exiv2::LogMsg::warn;
     if (level == 3)
-        Exiv2::LogMsg::setLevel(Exiv2::LogMsg::error);
+        logLevel = Exiv2::LogMsg::error;
     if (level == 4)
-        Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
+        logLevel = Exiv2::LogMsg::mute;
+    updateLogLevel();
 }
 
 
@@ -33,7 +33,12 @@
 #include <pybind11/pybind11.h>
 #include <exiv2/exiv2.hpp>
 
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace py = pybind11;
@@ -43,17 +48,46 @@ namespace exiv2wrapper
 
 class Image;
 
+// Static descriptors of the tags, shared by all the tags with the same key
+// (see the descriptor caches in exiv2wrapper.cpp).
+struct ExifTagInfo;
+struct IptcTagInfo;
+struct XmpTagInfo;
+
+// State of an image shared with the tags attached to it (a detached tag has
+// its own): the lock serialising the accesses to its metadata (see ImageLock
+// in exiv2wrapper.cpp), and the families of metadata modified since they were
+// last read or written.
+struct ImageState
+{
+    enum Family { exif = 1, iptc = 2, xmp = 4, comment = 8 };
+
+    std::recursive_mutex mutex;
+    int modified = 0;
+    // Bumped whenever datums are added to or erased from the IPTC data, which
+    // invalidates its iterators (it is a std::vector) even if the number of
+    // datums is unchanged, as when a tag loses values and another gains some.
+    unsigned long iptcChanges = 0;
+};
+
+typedef std::shared_ptr<ImageState> ImageStatePtr;
+
 class ExifTag
 {
 public:
     // Constructor
     ExifTag(const std::string& key,
             Exiv2::Exifdatum* datum=0, Exiv2::ExifData* data=0,
-            Exiv2::ByteOrder byteOrder=Exiv2::invalidByteOrder);
+            Exiv2::ByteOrder byteOrder=Exiv2::invalidByteOrder,
+            ImageStatePtr state=ImageStatePtr());
 
     ~ExifTag();
 
     void setRawValue(const std::string& value);
+    // Set the value from the items of an Exiv2 value of the type of the tag
+    // (int, float, (numerator, denominator), str, the fields of a date or
+    // bytes), without going through its string representation.
+    void setTypedValue(const py::list& items);
     void setParentImage(Image& image);
 
     const std::string getKey();
@@ -65,19 +99,24 @@ public:
     const std::string getSectionDescription();
     const std::string getRawValue();
     const std::string getHumanValue();
+    // Value read directly from the Exiv2 value, without going through its
+    // string representation: bytes for the byte types, None for the types
+    // not handled natively.
+    py::object getTypedValue();
     int getByteOrder();
 
 private:
+    // Mark the EXIF metadata of the parent image as modified if the value
+    // changed.
+    void _markModified(const std::string& before);
+
     Exiv2::ExifKey _key;
     Exiv2::Exifdatum* _datum;
     Exiv2::ExifData* _data;
-    std::string _type;
-    std::string _name;
-    std::string _label;
-    std::string _description;
-    std::string _sectionName;
-    std::string _sectionDescription;
+    ExifTagInfo* _info;
+    const char* _type;
     int _byteOrder;
+    ImageStatePtr _state;
 };
 
 
@@ -85,11 +124,17 @@ class IptcTag
 {
 public:
     // Constructor
-    IptcTag(const std::string& key, Exiv2::IptcData* data=0);
+    // nbValues is the number of values of the tag already set in data.
+    IptcTag(const std::string& key, Exiv2::IptcData* data=0,
+            size_t nbValues=0, ImageStatePtr state=ImageStatePtr());
 
     ~IptcTag();
 
     void setRawValues(const py::list& values);
+    // Set the values from an int, str, bytes or the fields of a date or time
+    // (with the signed hours and minutes of its offset) each, without going
+    // through their string representation.
+    void setTypedValues(const py::list& values);
     void setParentImage(Image& image);
 
     const std::string getKey();
@@ -102,19 +147,21 @@ public:
     const std::string getRecordName();
     const std::string getRecordDescription();
     const py::list getRawValues();
+    // Values read directly from the Exiv2 values, without going through
+    // their string representation (None for the types not handled natively).
+    const py::list getTypedValues();
 
 private:
     Exiv2::IptcKey _key;
     bool _from_data; // whether the tag is built from an existing IptcData
     Exiv2::IptcData* _data;
-    std::string _type;
-    std::string _name;
-    std::string _title;
-    std::string _description;
-    std::string _photoshopName;
-    bool _repeatable;
-    std::string _recordName;
-    std::string _recordDescription;
+    IptcTagInfo* _info;
+    ImageStatePtr _state;
+
+    void _checkRepeatable(size_t nbValues);
+    void _setValues(const std::vector<std::unique_ptr<Exiv2::Value>>& values);
+    void _overrideValues(
+        const std::vector<std::unique_ptr<Exiv2::Value>>& values);
 };
 
 
@@ -122,7 +169,8 @@ class XmpTag
 {
 public:
     // Constructor
-    XmpTag(const std::string& key, Exiv2::Xmpdatum* datum=0);
+    XmpTag(const std::string& key, Exiv2::Xmpdatum* datum=0,
+           ImageStatePtr state=ImageStatePtr());
 
     ~XmpTag();
 
@@ -145,28 +193,140 @@ private:
     Exiv2::XmpKey _key;
     bool _from_datum; // whether the tag is built from an existing Xmpdatum
     Exiv2::Xmpdatum* _datum;
-    std::string _exiv2_type;
-    std::string _type;
-    std::string _name;
-    std::string _title;
-    std::string _description;
+    const char* _exiv2_type;
+    XmpTagInfo* _info;
+    ImageStatePtr _state;
+
+    // Mark the XMP metadata of the parent image as modified if the value
+    // changed.
+    void _markModified(const std::string& before);
 };
 
 
 class Preview
 {
 public:
-    Preview(const Exiv2::PreviewImage& previewImage);
+    // Only the properties of the preview are known at construction time, its
+    // data is extracted from the image (a Python _Image, kept alive by the
+    // preview) the first time it is accessed.
+    Preview(py::object image, const Exiv2::PreviewProperties& properties);
 
-    py::object getData() const;
-    void writeToFile(const std::string& path) const;
+    py::object getData();
+    // Read-only view on the data of the preview, without copy.
+    py::buffer_info getBuffer();
+    void writeToFile(const std::string& path);
 
     std::string _mimeType;
     std::string _extension;
     unsigned int _size;
     py::tuple _dimensions;
-    std::string _data;
-    const Exiv2::byte* pData;
+
+private:
+    const Exiv2::PreviewImage& _fetch();
+
+    py::object _image;
+    Exiv2::PreviewProperties _properties;
+    std::shared_ptr<Exiv2::PreviewImage> _previewImage;
+};
+
+
+// Hash index of the keys of a metadata container (ExifData, IptcData or
+// XmpData), mapping each key to the iterators on its datums in the order of
+// the container (several for a repeated IPTC tag).
+// The index is built on the first lookup and rebuilt whenever the number of
+// datums or the count of changes passed by the caller changed. Erasing datums
+// from a container must be reported with invalidate() or remove(), or through
+// the count of changes, which has to be bumped by every addition or erasure
+// for a container whose iterators these invalidate (IptcData).
+template <typename Data>
+class KeyIndex
+{
+public:
+    typedef typename Data::iterator iterator;
+
+    KeyIndex(): _valid(false), _count(0), _changes(0) {}
+
+    // Return the iterators on the datums with the given key, or 0 if the key
+    // is not set.
+    const std::vector<iterator>* find(Data& data, const std::string& key,
+                                      unsigned long changes=0)
+    {
+        if (!_valid || _count != static_cast<size_t>(data.count()) ||
+            _changes != changes)
+        {
+            _build(data);
+            _changes = changes;
+        }
+        auto found = _iterators.find(key);
+        if (found == _iterators.end())
+        {
+            return 0;
+        }
+        return &found->second;
+    }
+
+    void invalidate() { _valid = false; }
+
+    // Forget the first datum with the given key, which has just been erased
+    // from a container whose other iterators stay valid (std::list).
+    void remove(const std::string& key)
+    {
+        auto found = _iterators.find(key);
+        if (!_valid || found == _iterators.end())
+        {
+            _valid = false;
+            return;
+        }
+        found->second.erase(found->second.begin());
+        if (found->second.empty())
+        {
+            _iterators.erase(found);
+        }
+        --_count;
+    }
+
+private:
+    void _build(Data& data)
+    {
+        _iterators.clear();
+        for (iterator i = data.begin(); i != data.end(); ++i)
+        {
+            _iterators[i->key()].push_back(i);
+        }
+        _count = static_cast<size_t>(data.count());
+        _valid = true;
+    }
+
+    bool _valid;
+    size_t _count;
+    unsigned long _changes;
+    std::unordered_map<std::string, std::vector<iterator> > _iterators;
+};
+
+
+// A file mapped read-only in memory, whose pages are only read from the disk
+// when accessed. Shared by an image opened mapped and the views on its data.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    const Exiv2::byte* data() const { return _data; };
+    size_t size() const { return _size; };
+
+    // Hint that the whole file is about to be read, in order.
+    void adviseSequential() const;
+
+    // Read-only view on the data of the file, without copy.
+    py::buffer_info getBuffer();
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    Exiv2::byte* _data;
+    size_t _size;
 };
 
 
@@ -175,13 +335,61 @@ class Image
 public:
     // Constructors
     Image(const std::string& filename);
-    Image(const std::string& buffer, unsigned long size);
+    // If mapped is true, the file is mapped read-only in memory and the
+    // image opened on its memory: the metadata is parsed from the pages
+    // accessed only, and the image can't be written back.
+    Image(const std::string& filename, bool mapped);
+    // The image is opened directly on the memory exposed by the object
+    // (bytes, bytearray, memoryview, mmap...), without any copy. A view
+    // on the object is held for the lifetime of the image.
+    Image(py::buffer buffer, long size);
+    // On a stream of Exiv2 created (under the GIL) by openIo, e.g. on a
+    // Python object (see openStream and openRange). The image can't be
+    // written back.
+    explicit Image(const std::function<Exiv2::BasicIo*()>& openIo);
+    // From an image already opened and read by Exiv2 (see readMany).
+    Image(const std::string& filename, Exiv2::Image::UniquePtr image);
     Image(const Image& image);
 
     ~Image();
 
-    void readMetadata();
-    void writeMetadata();
+    // Only the requested families of metadata are read, the parsers of the
+    // others are not invoked when possible (JPEG images); the tags of the
+    // makernotes may be left out. Metadata partially read can't be written.
+    void readMetadata(bool exif=true, bool iptc=true, bool xmp=true,
+                      bool makernote=true);
+    // Return false, without writing anything, if the metadata wasn't
+    // modified since it was read or last written.
+    // If patch is true and only the values of Exif tags were modified, each
+    // keeping its type and size, the new values are written over the old ones
+    // in the file, which is not rewritten.
+    bool writeMetadata(bool patch=false);
+    // Serialize the image with its current metadata to a new file, or to
+    // bytes if path is empty, in a single pass: neither the image nor its
+    // file are modified.
+    py::object writeMetadataTo(const std::string& path);
+    // Write the metadata to a temporary file next to the file of the image,
+    // flushed to the disk and renamed over it, keeping the access and
+    // modification times of the file if asked. A file with other hard links,
+    // or whose owner can't be kept, raises an error instead (see replaceFile
+    // in exiv2wrapper.cpp).
+    bool writeMetadataAtomic(bool preserveTimestamps=false);
+
+    // Read and write the XMP metadata from and to a sidecar file at path
+    // (an empty path to stop): the XMP metadata of the sidecar, if it exists,
+    // is merged on read with the one embedded in the image, over it, and the
+    // XMP metadata is written to the sidecar only. The image itself is only
+    // rewritten if its other metadata was modified, with its embedded XMP
+    // metadata unchanged.
+    void setXmpSidecar(const std::string& path);
+
+    // Names of the families of metadata read ("exif", "iptc", "xmp").
+    py::tuple loadedFamilies() const;
+
+    // Names of the families of metadata modified since they were read or
+    // last written ("exif", "iptc", "xmp", "comment"). Setting a tag to its
+    // current value doesn't modify it.
+    py::tuple modifiedFamilies() const;
 
     // Read-only access to the dimensions of the picture.
     unsigned int pixelWidth() const;
@@ -202,6 +410,11 @@ public:
     // Throw an exception if the tag is not set.
     const ExifTag getExifTag(std::string key);
 
+    // Lookups without any exception for a missing or invalid key: whether
+    // the tag is set, and the tag or None.
+    bool hasExifKey(const std::string& key);
+    py::object tryGetExifTag(const std::string& key);
+
     // Delete the required EXIF tag.
     // Throw an exception if the tag was not set.
     void deleteExifTag(std::string key);
@@ -219,6 +432,10 @@ public:
     // Throw an exception if the tag is not set.
     const IptcTag getIptcTag(std::string key);
 
+    // Lookups without any exception for a missing or invalid key.
+    bool hasIptcKey(const std::string& key);
+    py::object tryGetIptcTag(const std::string& key);
+
     // Delete (all the repetitions of) the required IPTC tag.
     // Throw an exception if the tag was not set.
     void deleteIptcTag(std::string key);
@@ -229,10 +446,23 @@ public:
     // Throw an exception if the tag is not set.
     const XmpTag getXmpTag(std::string key);
 
+    // Lookups without any exception for a missing or invalid key.
+    bool hasXmpKey(const std::string& key);
+    py::object tryGetXmpTag(const std::string& key);
+
     // Delete the required XMP tag.
     // Throw an exception if the tag was not set.
     void deleteXmpTag(std::string key);
 
+    // Return, in a single walk over the metadata, a list of
+    // (key, type, raw value) tuples for all the tags of a family. The raw
+    // values are those returned by the corresponding tag getters, except for
+    // the EXIF byte types whose data is returned as bytes; the values of a
+    // repeated IPTC tag are gathered in a single list.
+    py::list exifItems();
+    py::list iptcItems();
+    py::list xmpItems();
+
     // Comment
     const std::string getComment() const;
     void setComment(const std::string& comment);
@@ -241,14 +471,20 @@ public:
     // Read access to the thumbnail embedded in the image.
     py::list previews();
 
+    // Extract the data of one of the previews listed by previews(), without
+    // holding the GIL.
+    Exiv2::PreviewImage* getPreviewImage(
+        const Exiv2::PreviewProperties& properties);
+
     // Manipulate the JPEG/TIFF thumbnail embedded in the EXIF data.
     const std::string getExifThumbnailMimeType();
     const std::string getExifThumbnailExtension();
     void writeExifThumbnailToFile(const std::string& path);
-    py::list getExifThumbnailData();
+    py::bytes getExifThumbnailData();
     void eraseExifThumbnail();
     void setExifThumbnailFromFile(const std::string& path);
-    void setExifThumbnailFromData(const std::string& data);
+    // Accept any C-contiguous buffer (bytes, bytearray, memoryview...).
+    void setExifThumbnailFromData(py::buffer data);
 
     // Copy the metadata to another image.
     void copyMetadata(Image& other, bool exif=true, bool iptc=true, bool xmp=true) const;
@@ -256,6 +492,17 @@ public:
     // Return the image data buffer.
     py::bytes getDataBuffer() const;
 
+    // Return the size of the image data buffer.
+    unsigned long getDataSize() const;
+
+    // Return a read-only memoryview on the data of an image opened mapped,
+    // without copy, or None for the other images.
+    py::object getDataView() const;
+
+    // Copy the image data buffer into a pre-allocated writable buffer and
+    // return the number of bytes written.
+    unsigned long getDataBufferInto(py::buffer target) const;
+
     // Accessors
     Exiv2::ExifData* getExifData() { return _exifData; };
     Exiv2::IptcData* getIptcData() { return _iptcData; };
@@ -263,6 +510,10 @@ public:
 
     Exiv2::ByteOrder getByteOrder() const;
 
+    // State of the image, whose lock is taken by all its methods and by the
+    // tags attached to it.
+    ImageStatePtr getState() const { return _state; };
+
     const std::string getIptcCharset() const;
 
     // get XMP packet string
@@ -274,20 +525,72 @@ public:
 
 private:
     std::string _filename;
-    Exiv2::byte* _data;
+    const Exiv2::byte* _data;
     long _size;
+    // Keep the Python buffer alive (and its memory pinned) while the image
+    // may read from it.
+    std::shared_ptr<py::buffer_info> _bufferInfo;
+    // Keep the file of an image opened mapped in memory while the image may
+    // read from it.
+    std::shared_ptr<MappedFile> _mapping;
+    // Create the stream of an image opened on a stream (see Image).
+    std::function<Exiv2::BasicIo*()> _openIo;
     Exiv2::Image::UniquePtr _image;
+    ImageStatePtr _state;
     Exiv2::ExifData* _exifData;
     Exiv2::IptcData* _iptcData;
     Exiv2::XmpData* _xmpData;
+    // Indexes of the keys of the metadata, for the lookups by key.
+    KeyIndex<Exiv2::ExifData> _exifIndex;
+    KeyIndex<Exiv2::IptcData> _iptcIndex;
+    KeyIndex<Exiv2::XmpData> _xmpIndex;
     Exiv2::ExifThumb* _exifThumbnail;
     Exiv2::ExifThumb* _getExifThumbnail();
 
     // true if the image's internal metadata has already been read,
     // false otherwise
     bool _dataRead;
+    // Families of metadata read, and whether any family or the makernotes
+    // were left out (see readMetadata)
+    bool _exifRead;
+    bool _iptcRead;
+    bool _xmpRead;
+    bool _partialRead;
+    // Dimensions of the picture read with a partial read of a JPEG image,
+    // which can't be set on the Exiv2 image (0 otherwise).
+    unsigned int _pixelWidth;
+    unsigned int _pixelHeight;
+    // The XMP sidecar (see setXmpSidecar), and the XMP metadata embedded in
+    // the image, written back in place of the one of the sidecar.
+    std::string _sidecarPath;
+    Exiv2::XmpData _embeddedXmp;
 
     void _instantiate_image();
+
+    // Throw an exception if the metadata can't be written.
+    void _checkWritable() const;
+
+    // Rewrite the image with its current metadata into a new image in
+    // memory, leaving the image untouched. Called without the GIL.
+    Exiv2::Image::UniquePtr _writeToMemory() const;
+
+    // Overwrite the values of the Exif tags modified in the file of the
+    // image. Return false, leaving the file untouched, if the changes can't
+    // be written in place. Called without the GIL.
+    bool _patchExifData();
+
+    // The families of metadata modified to write to the image itself, and
+    // not to its XMP sidecar.
+    int _imageModified() const;
+
+    // Read the XMP sidecar, and write it atomically when possible. Called
+    // without the GIL.
+    void _readXmpSidecar();
+    void _writeXmpSidecar();
+
+    // Read the whole image stream into dest in one pass. Called without
+    // the GIL.
+    size_t _readDataBuffer(Exiv2::byte* dest, size_t size) const;
 };
 
 
@@ -295,6 +598,24 @@ private:
 void translateExiv2Error(Exiv2::Error const& error);
 
 
+// Open and read the metadata of a list of image files on a pool of native
+// threads, with the GIL released for the whole batch.
+// Return a list holding, for each path, either a read Image or the Python
+// exception raised when opening or reading it.
+py::list readMany(const py::list& paths, unsigned int threads=0);
+
+// Open an image on a Python binary file object (see Image), without reading
+// its metadata.
+py::object openStream(py::object stream, size_t bufferSize=65536);
+
+// Open an image of size bytes on a Python callable fetching its data by
+// ranges, fetch(offset, length), through a cache of cacheBlocks blocks of
+// blockSize bytes: a missing block is fetched with the readahead following
+// blocks in a single call. The metadata is not read.
+py::object openRange(py::object fetch, size_t size, size_t blockSize=65536,
+                     size_t cacheBlocks=32, size_t readahead=1);
+
+
 // Functions to manipulate custom XMP namespaces
 bool initialiseXmpParser();
 bool closeXmpParser();
@@ -303,6 +624,8 @@ void unregisterXmpNs(const std::string& name);
 void unregisterAllXmpNs();
 
 // Exiv2 log functions
+// Install the log handler, once at import time.
+void setupLog();
 void initLog();
 void setLogLevel(int level);
 
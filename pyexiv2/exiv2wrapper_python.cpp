@@ -42,7 +42,14 @@ using namespace exiv2wrapper;
 namespace py = pybind11;
 
 
+// The module doesn't rely on the GIL: the metadata of each image is guarded
+// by its own lock, and the state shared by the images by dedicated locks, so
+// that it can be run on the free-threaded builds of CPython (pybind11 2.13+).
+#if PYBIND11_VERSION_HEX >= 0x020D0000
+PYBIND11_MODULE(libexiv2python, m, py::mod_gil_not_used())
+#else
 PYBIND11_MODULE(libexiv2python, m)
+#endif
 {
     m.attr("exiv2_version_info") = \
          py::make_tuple(EXIV2_MAJOR_VERSION,
@@ -67,11 +74,18 @@ PYBIND11_MODULE(libexiv2python, m)
     // (if it was compiled with DEBUG or without SUPPRESS_WARNINGS).
     // See https://bugs.launchpad.net/pyexiv2/+bug/507620.
     std::cerr.rdbuf(NULL);
+    // The messages of libexiv2 are then muted until initLog is called.
+    setupLog();
+
+    // Initialise the XMP toolkit with its lock before anything else uses it,
+    // as the metadata may then be read and written from several threads.
+    initialiseXmpParser();
 
     py::class_<ExifTag>(m, "_ExifTag")
         .def(py::init<std::string>())
 
         .def("_setRawValue", &ExifTag::setRawValue)
+        .def("_setTypedValue", &ExifTag::setTypedValue)
         .def("_setParentImage", &ExifTag::setParentImage)
 
         .def("_getKey", &ExifTag::getKey)
@@ -83,6 +97,7 @@ PYBIND11_MODULE(libexiv2python, m)
         .def("_getSectionDescription", &ExifTag::getSectionDescription)
         .def("_getRawValue", &ExifTag::getRawValue)
         .def("_getHumanValue", &ExifTag::getHumanValue)
+        .def("_getTypedValue", &ExifTag::getTypedValue)
         .def("_getByteOrder", &ExifTag::getByteOrder)
     ;
 
@@ -90,6 +105,7 @@ PYBIND11_MODULE(libexiv2python, m)
         .def(py::init<std::string>())
 
         .def("_setRawValues", &IptcTag::setRawValues)
+        .def("_setTypedValues", &IptcTag::setTypedValues)
         .def("_setParentImage", &IptcTag::setParentImage)
 
         .def("_getKey", &IptcTag::getKey)
@@ -102,6 +118,7 @@ PYBIND11_MODULE(libexiv2python, m)
         .def("_getRecordName", &IptcTag::getRecordName)
         .def("_getRecordDescription", &IptcTag::getRecordDescription)
         .def("_getRawValues", &IptcTag::getRawValues)
+        .def("_getTypedValues", &IptcTag::getTypedValues)
     ;
 
     py::class_<XmpTag>(m, "_XmpTag")
@@ -123,25 +140,40 @@ PYBIND11_MODULE(libexiv2python, m)
         .def("_getLangAltValue", &XmpTag::getLangAltValue)
     ;
 
-    py::class_<Preview>(m, "_Preview")
-        .def(py::init<Exiv2::PreviewImage>())
+    py::class_<Preview>(m, "_Preview", py::buffer_protocol())
+        .def_buffer(&Preview::getBuffer)
 
         .def_readonly("mime_type", &Preview::_mimeType)
         .def_readonly("extension", &Preview::_extension)
         .def_readonly("size", &Preview::_size)
         .def_readonly("dimensions", &Preview::_dimensions)
-        .def_readonly("data", &Preview::_data)
 
         .def("get_data", &Preview::getData)
         .def("write_to_file", &Preview::writeToFile)
     ;
 
+    py::class_<MappedFile, std::shared_ptr<MappedFile> >(
+            m, "_MappedFile", py::buffer_protocol())
+        .def_buffer(&MappedFile::getBuffer)
+    ;
+
     py::class_<Image>(m, "_Image")
         .def(py::init<std::string>())
-        .def(py::init<std::string, long>())
-
-        .def("_readMetadata", &Image::readMetadata)
-        .def("_writeMetadata", &Image::writeMetadata)
+        .def(py::init<std::string, bool>())
+        .def(py::init<py::buffer, long>())
+
+        .def("_readMetadata", &Image::readMetadata,
+             py::arg("exif") = true, py::arg("iptc") = true,
+             py::arg("xmp") = true, py::arg("makernote") = true)
+        .def("_writeMetadata", &Image::writeMetadata,
+             py::arg("patch") = false)
+        .def("_writeMetadataTo", &Image::writeMetadataTo,
+             py::arg("path") = std::string())
+        .def("_writeMetadataAtomic", &Image::writeMetadataAtomic,
+             py::arg("preserve_timestamps") = false)
+        .def("_setXmpSidecar", &Image::setXmpSidecar)
+        .def("_loadedFamilies", &Image::loadedFamilies)
+        .def("_modifiedFamilies", &Image::modifiedFamilies)
 
         .def("_getPixelWidth", &Image::pixelWidth)
         .def("_getPixelHeight", &Image::pixelHeight)
@@ -150,16 +182,26 @@ PYBIND11_MODULE(libexiv2python, m)
 
         .def("_exifKeys", &Image::exifKeys)
         .def("_getExifTag", &Image::getExifTag)
+        .def("_hasExifKey", &Image::hasExifKey)
+        .def("_tryGetExifTag", &Image::tryGetExifTag)
         .def("_deleteExifTag", &Image::deleteExifTag)
 
         .def("_iptcKeys", &Image::iptcKeys)
         .def("_getIptcTag", &Image::getIptcTag)
+        .def("_hasIptcKey", &Image::hasIptcKey)
+        .def("_tryGetIptcTag", &Image::tryGetIptcTag)
         .def("_deleteIptcTag", &Image::deleteIptcTag)
 
         .def("_xmpKeys", &Image::xmpKeys)
         .def("_getXmpTag", &Image::getXmpTag)
+        .def("_hasXmpKey", &Image::hasXmpKey)
+        .def("_tryGetXmpTag", &Image::tryGetXmpTag)
         .def("_deleteXmpTag", &Image::deleteXmpTag)
 
+        .def("_exifItems", &Image::exifItems)
+        .def("_iptcItems", &Image::iptcItems)
+        .def("_xmpItems", &Image::xmpItems)
+
         .def("_getComment", &Image::getComment)
         .def("_setComment", &Image::setComment)
         .def("_clearComment", &Image::clearComment)
@@ -169,6 +211,9 @@ PYBIND11_MODULE(libexiv2python, m)
         .def("_copyMetadata", &Image::copyMetadata)
 
         .def("_getDataBuffer", &Image::getDataBuffer)
+        .def("_getDataSize", &Image::getDataSize)
+        .def("_getDataView", &Image::getDataView)
+        .def("_getDataBufferInto", &Image::getDataBufferInto)
 
         .def("_getExifThumbnailMimeType", &Image::getExifThumbnailMimeType)
         .def("_getExifThumbnailExtension", &Image::getExifThumbnailExtension)
@@ -194,5 +239,12 @@ PYBIND11_MODULE(libexiv2python, m)
     m.def("_unregisterXmpNs", unregisterXmpNs, py::arg("name"));
     m.def("_unregisterAllXmpNs", unregisterAllXmpNs);
 
+    m.def("_readMany", readMany, py::arg("paths"), py::arg("threads") = 0);
+    m.def("_openStream", openStream, py::arg("stream"),
+          py::arg("buffer_size") = 65536);
+    m.def("_openRange", openRange, py::arg("fetch"), py::arg("size"),
+          py::arg("block_size") = 65536, py::arg("cache_blocks") = 32,
+          py::arg("readahead") = 1);
+
 };
 
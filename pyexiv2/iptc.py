@@ -112,12 +112,42 @@ class IptcTag(ListenerInterface):
         tag._values_cookie = True
         return tag
 
+    @staticmethod
+    def _from_item(item, _image):
+        # Build a tag from a (key, type, raw values) item of a metadata
+        # snapshot (see ImageMetadata.prefetch). The underlying
+        # libexiv2python._IptcTag is only fetched from the image when it is
+        # needed, e.g. to modify the tag.
+        tag = IptcTag.__new__(IptcTag)
+        tag.__tag = None
+        tag._item = (item[0], item[1], _image)
+        tag._raw_values = item[2]
+        tag._values = None
+        tag._values_cookie = True
+        return tag
+
+    def _get_tag(self):
+        if self.__tag is None:
+            # Built from a snapshot item, bind it to the image now.
+            key, type_, image = self._item
+            self.__tag = image._getIptcTag(key)
+            self._item = None
+        return self.__tag
+
+    def _set_tag(self, _tag):
+        self.__tag = _tag
+        self._item = None
+
+    _tag = property(fget=_get_tag, fset=_set_tag)
+
     @property
     def key(self):
         """The key of the tag in the dotted form
         ``familyName.groupName.tagName`` where ``familyName`` = ``iptc``.
 
         """
+        if self._item is not None:
+            return self._item[0]
         return self._tag._getKey()
 
     @property
@@ -126,6 +156,8 @@ class IptcTag(ListenerInterface):
         Undefined).
 
         """
+        if self._item is not None:
+            return self._item[1]
         return self._tag._getType()
 
     @property
@@ -193,8 +225,14 @@ class IptcTag(ListenerInterface):
 
     def _compute_values(self):
         # Lazy computation of the values from the raw values
-        self._values = NotifyingList([self._convert_to_python(v) 
-                                        for v in self._raw_values])
+        if self._item is None:
+            # Most types are read natively, without parsing the raw values
+            typed = self._tag._getTypedValues()
+            values = [self._convert_typed_to_python(t, v)
+                      for t, v in zip(typed, self._raw_values)]
+        else:
+            values = [self._convert_to_python(v) for v in self._raw_values]
+        self._values = NotifyingList(values)
         self._values.register_listener(self)
         self._values_cookie = False
 
@@ -208,7 +246,14 @@ class IptcTag(ListenerInterface):
         if not isinstance(values, (list, tuple)):
             raise TypeError('Expecting a list of values')
 
-        self.raw_value = [self._convert_to_string(v) for v in values]
+        if self.type in ('Short', 'String', 'Date', 'Time'):
+            # Set natively, without formatting the raw values
+            self._tag._setTypedValues([self._convert_to_item(v)
+                                       for v in values])
+            self._raw_values = self._tag._getRawValues()
+
+        else:
+            self.raw_value = [self._convert_to_string(v) for v in values]
 
         if isinstance(self._values, NotifyingList):
             self._values.unregister_listener(self)
@@ -234,6 +279,36 @@ class IptcTag(ListenerInterface):
         # The following is a quick, non optimal solution.
         self._set_values(self._values)
 
+    def _convert_typed_to_python(self, typed, value):
+        """Convert one value read natively (see _IptcTag._getTypedValues) to
+        its corresponding python type.
+
+        Args:
+        typed -- an int, the fields of a date, the fields of a time followed
+                 by the sign and absolute value of its offset, or None if the
+                 raw value has to be converted
+        value -- the corresponding raw value
+
+        Return: the value converted to its corresponding python type
+
+        Raise IptcValueError: if the conversion fails
+        """
+        if typed is None:
+            return self._convert_to_python(value)
+
+        elif not isinstance(typed, tuple):
+            return typed
+
+        try:
+            if len(typed) == 3:
+                return datetime.date(*typed)
+
+            hours, minutes, seconds, sign, ohours, ominutes = typed
+            tzinfo = FixedOffset(sign, ohours, ominutes)
+            return datetime.time(hours, minutes, seconds, tzinfo=tzinfo)
+        except ValueError:
+            raise IptcValueError(value, self.type)
+
     def _convert_to_python(self, value):
         """Convert one raw value to its corresponding python type.
 
@@ -302,6 +377,44 @@ class IptcTag(ListenerInterface):
 
         raise IptcValueError(value, self.type)
 
+    def _convert_to_item(self, value):
+        """Convert one value of a Short, String, Date or Time tag to the item
+        of the corresponding libexiv2 value, to be set natively (see
+        _IptcTag._setTypedValues).
+
+        Args:
+        value -- the value to be converted
+
+        Return: an int, a string, the fields of a date, or the fields of a
+                time followed by the signed hours and minutes of its offset
+
+        Raise IptcValueError: if the conversion fails
+        """
+        if self.type == 'Short':
+            if isinstance(value, int):
+                return value
+
+        elif self.type == 'String':
+            if isinstance(value, (str, bytes)):
+                return value
+
+        elif self.type == 'Date':
+            if isinstance(value, (datetime.date, datetime.datetime)):
+                return (value.year, value.month, value.day)
+
+        elif self.type == 'Time':
+            if isinstance(value, (datetime.time, datetime.datetime)):
+                ohours = ominutes = 0
+                offset = value.utcoffset() if value.tzinfo else None
+                if offset is not None:
+                    seconds = offset.total_seconds()
+                    ohours = int(seconds / 3600)
+                    ominutes = int((seconds - ohours * 3600) / 60)
+                return (value.hour, value.minute, value.second,
+                        ohours, ominutes)
+
+        raise IptcValueError(value, self.type)
+
     def _convert_to_string(self, value):
         """Convert one value to its corresponding string representation,
         suitable to pass to libexiv2.
@@ -59,15 +59,32 @@ class ImageMetadata(MutableMapping):
     It also provides access to the previews embedded in an image.
     """
 
-    def __init__(self, filename, fsencoding=None):
+    def __init__(self, filename, fsencoding=None, sidecar=False, mapped=False):
         """Instanciate the ImageMeatadata class.
 
         Args:
         filename: str(path to an image file)
         fsencoding: str(encoding of filesystem).
+        sidecar: whether to read and write the XMP metadata from and to an
+                 XMP sidecar file: True for the file next to the image with
+                 the extension .xmp, or str(path to the sidecar file).
+                 The XMP metadata of the sidecar, if it exists, is merged with
+                 the one embedded in the image on read, and written to the
+                 sidecar only: the image file is only rewritten if its other
+                 metadata is modified, with its embedded XMP metadata
+                 unchanged.
+        mapped: whether to map the image file read-only in memory: only the
+                pages of the file accessed by the parsers are read, and
+                :attr:`buffer_view` exposes the data of the image without
+                copy. The image can't be written back (but its XMP sidecar
+                can).
         """
         self.filename = filename
         self.fsencoding = fsencoding
+        if sidecar is True:
+            sidecar = os.path.splitext(filename)[0] + '.xmp'
+        self.sidecar = os.fspath(sidecar) if sidecar else None
+        self.mapped = mapped
         self.__image = None
         self._keys = {'exif': None, 'iptc': None, 'xmp': None}
         self._tags = {'exif': {}, 'iptc': {}, 'xmp': {}}
@@ -88,19 +105,116 @@ class ImageMetadata(MutableMapping):
         stat = os.stat(filename)
         self._atime = stat.st_atime
         self._mtime = stat.st_mtime
-        return libexiv2python._Image(filename.encode(self.fsencoding) if self.fsencoding else filename)
+        return libexiv2python._Image(filename.encode(self.fsencoding) if self.fsencoding else filename,
+                                     self.mapped)
 
     @classmethod
     def from_buffer(cls, buffer_):
-        """Instantiate an image container from an image memoryview.
+        """Instantiate an image container from an image buffer.
+
+        The image data is not copied: the buffer is referenced (and cannot
+        be resized) as long as the image container is alive.
+
+        Args:
+        buffer_ -- any object supporting the buffer protocol (bytes,
+                   bytearray, memoryview, mmap...) containing image data
+        """
+        obj = cls(None)
+        obj.__image = libexiv2python._Image(buffer_,
+                                            memoryview(buffer_).nbytes)
+        return obj
+
+    @classmethod
+    def from_stream(cls, stream, buffer_size=65536):
+        """Instantiate an image container on a binary file object.
+
+        The image is read from the current position of the object through
+        its readinto(), seek() and tell() methods, with a read-ahead buffer:
+        only the parts of the image holding the metadata are read (but for
+        some formats, e.g. TIFF, read as a whole). The object must be kept
+        open as long as the image container is used. The image can't be
+        written back.
+
+        Args:
+        stream -- a seekable binary file object (e.g. an io.BufferedReader)
+        buffer_size -- size in bytes of the read-ahead buffer, default 65536
+        """
+        obj = cls(None)
+        obj.__image = libexiv2python._openStream(stream, buffer_size)
+        return obj
+
+    @classmethod
+    def from_fetch(cls, fetch, size, block_size=65536, cache_blocks=32,
+                   readahead=1):
+        """Instantiate an image container on an object of a remote store (e.g.
+        an S3-compatible store), read through ranged requests.
+
+        The image is read by blocks, fetched on demand and cached: a missing
+        block is fetched together with the following ones (see readahead),
+        so that reading the metadata of an image only takes a few small
+        requests (but for some formats, e.g. TIFF, read as a whole). The
+        image can't be written back.
 
         Args:
-        buffer_ -- a memoryview containing image data as bytes
+        fetch -- a callable returning the bytes (or any bytes-like object)
+                 of the range of the object given as (offset, length)
+        size -- the size in bytes of the object
+        block_size -- size in bytes of the blocks, default 65536
+        cache_blocks -- number of blocks cached, the least recently used
+                        ones being dropped, default 32
+        readahead -- number of blocks following a missing block fetched with
+                     it in the same request, default 1
         """
         obj = cls(None)
-        obj.__image = libexiv2python._Image(buffer_, len(buffer_))
+        obj.__image = libexiv2python._openRange(fetch, size, block_size,
+                                                cache_blocks, readahead)
         return obj
 
+    @classmethod
+    def read_many(cls, filenames, threads=0, fsencoding=None):
+        """Read the metadata of several image files in one native call.
+
+        The files are opened and their metadata parsed by a pool of native
+        threads, the GIL being released for the whole batch.
+
+        Args:
+        filenames -- list of paths to image files
+        threads -- number of worker threads, default 0 (one per CPU core)
+        fsencoding -- str(encoding of filesystem)
+
+        Return: a list holding, for each file, either an ImageMetadata
+                instance whose metadata has been read, or the exception
+                raised while opening or reading the file
+        """
+        results = [None] * len(filenames)
+        names = []
+        indexes = []
+        for index, filename in enumerate(filenames):
+            obj = cls(filename, fsencoding)
+            try:
+                # Remember the reference timestamps before doing any access
+                # to the file
+                stat = os.stat(filename)
+            except OSError as error:
+                results[index] = error
+                continue
+
+            obj._atime = stat.st_atime
+            obj._mtime = stat.st_mtime
+            results[index] = obj
+            names.append(filename.encode(fsencoding) if fsencoding else filename)
+            indexes.append(index)
+
+        images = libexiv2python._readMany(names, threads)
+        for index, image in zip(indexes, images):
+            if isinstance(image, Exception):
+                results[index] = image
+
+            else:
+                results[index].__image = image
+
+        return results
+
     @property
     def _image(self):
         if self.__image is None:
@@ -108,39 +222,123 @@ class ImageMetadata(MutableMapping):
 
         return self.__image
 
-    def read(self):
+    def read(self, exif=True, iptc=True, xmp=True, makernote=True):
         """Read the metadata embedded in the associated image.
 
         It is necessary to call this method once before attempting to access
         the metadata (an exception will be raised if trying to access metadata
         before calling this method).
+
+        Reading only the families of metadata needed is much faster, notably
+        for JPEG images whose other families are not parsed at all. Accessing
+        the tags of a family not read raises an exception (see
+        loaded_families), and metadata partially read can't be written.
+
+        Args:
+        exif -- whether to read the EXIF metadata, default True
+        iptc -- whether to read the IPTC metadata, default True
+        xmp -- whether to read the XMP metadata, default True
+        makernote -- whether to keep the makernote tags in the EXIF metadata,
+                     default True
         """
         if self.__image is None:
             self.__image = self._instantiate_image(self.filename)
+            if self.sidecar is not None:
+                self.__image._setXmpSidecar(
+                    self.sidecar.encode(self.fsencoding) if self.fsencoding
+                    else self.sidecar)
+
+        self.__image._readMetadata(exif, iptc, xmp, makernote)
+        self._keys = {'exif': None, 'iptc': None, 'xmp': None}
+        self._tags = {'exif': {}, 'iptc': {}, 'xmp': {}}
+        self._exif_thumbnail = None
 
-        self.__image._readMetadata()
+    @property
+    def loaded_families(self):
+        """The families of metadata read, among 'exif', 'iptc' and 'xmp'.
+
+        """
+        return self._image._loadedFamilies()
 
-    def write(self, preserve_timestamps=False):
+    @property
+    def modified_families(self):
+        """The families of metadata modified since they were read or last
+        written, among 'exif', 'iptc', 'xmp' and 'comment'.
+
+        Setting a tag to its current value doesn't modify the metadata.
+        """
+        return self._image._modifiedFamilies()
+
+    def write(self, preserve_timestamps=False, atomic=False, patch=False):
         """Write the metadata back to the image.
 
         Args:
         preserve_timestamps -- whether to preserve the file's original
                                timestamps (access time and modification time)
                                Type: boolean
-        """
-        self._image._writeMetadata()
+        atomic -- whether to write the image to a temporary file next to it,
+                  flushed to the disk and renamed over it, so that a crash
+                  can't leave a corrupted file. The timestamps of the file
+                  are then preserved natively, to the nanosecond. The target
+                  of a symbolic link is replaced; a file with other hard
+                  links, or whose owner can't be kept, raises an IOError and
+                  is left untouched.
+                  Type: boolean
+        patch -- whether to overwrite the values of the EXIF tags modified in
+                 the file when possible, instead of rewriting the whole file.
+                 It is possible if only EXIF tags were modified, each keeping
+                 its type and size (e.g. a rating, or a string of the same
+                 length), and none was added nor deleted; the whole file is
+                 rewritten otherwise. Not compatible with atomic.
+                 Type: boolean
+
+        Return: whether the image was written. It isn't if the metadata
+        wasn't modified since it was read or last written (see
+        :attr:`modified_families`).
+        """
+        if atomic and patch:
+            raise ValueError('An atomic write cannot patch the file')
+
         if self.filename is None:
-            return
+            return self._image._writeMetadata(patch)
 
-        if preserve_timestamps:
-            # Revert to the original timestamps
-            os.utime(self.filename, (self._atime, self._mtime))
+        if atomic:
+            # The timestamps are preserved natively.
+            written = self._image._writeMetadataAtomic(preserve_timestamps)
 
         else:
+            written = self._image._writeMetadata(patch)
+            if written and preserve_timestamps:
+                # Revert to the original timestamps
+                os.utime(self.filename, (self._atime, self._mtime))
+
+        if written and not preserve_timestamps:
             # Reset the reference timestamps
             stat = os.stat(self.filename)
             self._atime = stat.st_atime
             self._mtime = stat.st_mtime
+        return written
+
+    def write_to(self, path=None):
+        """Write the image with its current metadata to a new file, or to
+        bytes, without modifying the image nor its file.
+
+        The image is serialized in a single pass, without any temporary file.
+
+        Args:
+        path -- the path of the file to write (overwritten if it exists), or
+                None to return the data of the image
+                Type: string or path-like object
+
+        Return: the data of the image as bytes if path is None, else None
+        """
+        if path is None:
+            return self._image._writeMetadataTo()
+
+        path = os.fspath(path)
+        if not path:
+            raise ValueError('Empty path')
+        self._image._writeMetadataTo(path)
 
     @property
     def dimensions(self):
@@ -187,6 +385,28 @@ class ImageMetadata(MutableMapping):
 
         return self._keys['xmp']
 
+    def prefetch(self):
+        """Fetch the keys and raw values of all the tags in one native call
+        per family of metadata (EXIF, IPTC and XMP).
+
+        This is much faster than accessing the tags one by one when most of
+        them are to be read. The tags already accessed are left untouched.
+        """
+        families = (('exif', self._image._exifItems, ExifTag),
+                    ('iptc', self._image._iptcItems, IptcTag),
+                    ('xmp', self._image._xmpItems, XmpTag))
+        loaded = self.loaded_families
+        for family, get_items, tag_class in families:
+            if family not in loaded:
+                continue
+
+            items = get_items()
+            self._keys[family] = [item[0] for item in items]
+            tags = self._tags[family]
+            for item in items:
+                if item[0] not in tags:
+                    tags[item[0]] = tag_class._from_item(item, self._image)
+
     def _get_exif_tag(self, key):
         """Return the EXIF tag for the given key.
 
@@ -252,6 +472,64 @@ class ImageMetadata(MutableMapping):
         else:
             raise KeyError(key)
 
+    def __contains__(self, key):
+        """Return whether a metadata tag is set for a given key.
+
+        The lookup is done natively, without raising any exception for a
+        missing key.
+
+        Args:
+        key -- metadata key in the dotted form
+               ``familyName.groupName.tagName``
+        """
+        family = key.split('.')[0].lower()
+        if family == 'exif':
+            has_key = self._image._hasExifKey
+        elif family == 'iptc':
+            has_key = self._image._hasIptcKey
+        elif family == 'xmp':
+            has_key = self._image._hasXmpKey
+        else:
+            return False
+
+        return key in self._tags[family] or has_key(key)
+
+    def get(self, key, default=None):
+        """Return the metadata tag for a given key, or default if the tag
+        doesn't exist.
+
+        The lookup is done natively, without raising any exception for a
+        missing key.
+
+        Args:
+        key -- metadata key in the dotted form
+               ``familyName.groupName.tagName``
+        default -- the value returned for a missing key, default None
+        """
+        family = key.split('.')[0].lower()
+        if family == 'exif':
+            try_get, tag_class = self._image._tryGetExifTag, ExifTag
+        elif family == 'iptc':
+            try_get, tag_class = self._image._tryGetIptcTag, IptcTag
+        elif family == 'xmp':
+            try_get, tag_class = self._image._tryGetXmpTag, XmpTag
+        else:
+            return default
+
+        tags = self._tags[family]
+        tag = tags.get(key)
+        if tag is None:
+            _tag = try_get(key)
+            if _tag is None:
+                return default
+
+            tag = tag_class._from_existing_tag(_tag)
+            # Cache the tag under its canonical key, which differs from the
+            # key given for a numeric tag name (e.g. 'Exif.Image.0x010f').
+            tag = tags.setdefault(tag.key, tag)
+
+        return tag
+
     def _set_exif_tag(self, key, tag_or_value):
         """Set an EXIF tag. If the tag already exists, its value is overwritten.
 
@@ -417,7 +695,9 @@ class ImageMetadata(MutableMapping):
             raise KeyError(key)
 
     def __iter__(self):
-        return chain(self.exif_keys, self.iptc_keys, self.xmp_keys)
+        # Only the keys of the families read
+        return chain(*[getattr(self, '%s_keys' % family)
+                       for family in self.loaded_families])
 
     def __len__(self):
         return len([x for x in self])
@@ -488,6 +768,37 @@ class ImageMetadata(MutableMapping):
         """
         return self._image._getDataBuffer()
 
+    @property
+    def buffer_view(self):
+        """A read-only memoryview on the image buffer: without copy for an
+        image opened mapped, on a copy of :attr:`buffer` otherwise.
+        """
+        view = self._image._getDataView()
+        if view is None:
+            view = memoryview(self._image._getDataBuffer())
+        return view
+
+    @property
+    def buffer_size(self):
+        """The size in bytes of the image buffer.
+
+        """
+        return self._image._getDataSize()
+
+    def buffer_readinto(self, target):
+        """Copy the image buffer into a pre-allocated writable buffer.
+
+        This allows to reuse the same buffer (e.g. a bytearray) for several
+        images instead of allocating a new bytes object each time.
+
+        Args:
+        target -- a writable object supporting the buffer protocol, at least
+                  :attr:`buffer_size` bytes long
+
+        Return: the number of bytes written
+        """
+        return self._image._getDataBufferInto(target)
+
     @property
     def exif_thumbnail(self):
         """A thumbnail image optionally embedded in the EXIF data.
@@ -32,6 +32,8 @@ Provide the Preview class.
 class Preview(object):
     """A preview image (properties and data buffer) embedded in image metadata.
 
+    The properties of the preview are read along with the list of previews,
+    whereas its data is only extracted from the image when first accessed.
     """
 
     def __init__(self, preview):
@@ -73,6 +75,13 @@ class Preview(object):
         """
         return self.__preview.get_data()
 
+    @property
+    def buffer(self):
+        """A read-only memoryview on the preview image data, without copy.
+
+        """
+        return memoryview(self.__preview)
+
     def write_to_file(self, path):
         """Write the preview image to a file on disk.
 
@@ -138,12 +138,44 @@ class XmpTag(object):
         tag._value_cookie = True
         return tag
 
+    @staticmethod
+    def _from_item(item, _image):
+        """Build a tag from a (key, type, raw value) item of a metadata
+        snapshot (see ImageMetadata.prefetch).
+
+        The underlying libexiv2python._XmpTag is only fetched from the image
+        when it is needed, e.g. to modify the tag.
+        """
+        tag = XmpTag.__new__(XmpTag)
+        tag.__tag = None
+        tag._item = (item[0], item[1], _image)
+        tag._raw_value = item[2]
+        tag._value = None
+        tag._value_cookie = True
+        return tag
+
+    def _get_tag(self):
+        if self.__tag is None:
+            # Built from a snapshot item, bind it to the image now.
+            key, type_, image = self._item
+            self.__tag = image._getXmpTag(key)
+            self._item = None
+        return self.__tag
+
+    def _set_tag(self, _tag):
+        self.__tag = _tag
+        self._item = None
+
+    _tag = property(fget=_get_tag, fset=_set_tag)
+
     @property
     def key(self):
         """The key of the tag in the dotted form
         ``familyName.groupName.tagName`` where ``familyName`` = ``xmp``.
 
         """
+        if self._item is not None:
+            return self._item[0]
         return self._tag._getKey()
 
     @property
@@ -151,6 +183,8 @@ class XmpTag(object):
         """The XMP type of the tag.
 
         """
+        if self._item is not None:
+            return self._item[1]
         return self._tag._getType()
 
     @property
@@ -580,14 +614,9 @@ def initialiseXmpParser():
     Calling this method is usually not needed, as encode() and decode() will 
     initialize the XMP Toolkit if necessary.
 
-    The function takes optional pointers to a callback function xmpLockFct and 
-    related data pLockData that the parser uses when XMP namespaces are 
-    subsequently registered.
-
-    This function itself still is not thread-safe and needs to be 
-    called in a thread-safe manner (e.g., on program startup), but if used with 
-    suitable additional locking parameters, any subsequent registration of 
-    namespaces will be thread-safe.
+    The parser is initialised with a lock when the module is imported, so
+    that XMP metadata can be read and written, and namespaces registered,
+    from several threads at once.
     """
     libexiv2python._initialiseXmpParser()
 
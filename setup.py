@@ -88,6 +88,7 @@ setup(
             include_dirs=incdirs,
             library_dirs=libdirs,
             libraries=altlibs,
+            cxx_std=17,
         ),
     ],
 )
@@ -42,6 +42,7 @@ from utils import TestConversions, TestFractions
 from test_usercomment import TestUserCommentReadWrite, TestUserCommentAdd
 from test_pickling import TestPicklingTags
 from test_datetimeformatter import TestDateTimeFormatter
+from test_threads import TestThreads
 
 
 def run_unit_tests():
@@ -63,6 +64,7 @@ def run_unit_tests():
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestUserCommentAdd))
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestPicklingTags))
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestDateTimeFormatter))
+    suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestThreads))
     # Run the test suite
     return unittest.TextTestRunner(verbosity=2).run(suite)
 
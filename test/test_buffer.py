@@ -25,8 +25,12 @@
 # ******************************************************************************
 
 import unittest
+import io
+import os
 import os.path
+import sys
 import hashlib
+import tempfile
 from datetime import datetime
 
 from pyexiv2.metadata import ImageMetadata
@@ -89,3 +93,135 @@ class TestBuffer(unittest.TestCase):
         m2.read()
         self.assertEqual(m2[key].value, value)
 
+
+    def test_from_bytearray_and_memoryview(self):
+        fd = open(self.filepath, 'rb')
+        data = fd.read()
+        fd.close()
+        for buffer_ in (bytearray(data), memoryview(data)):
+            m = ImageMetadata.from_buffer(buffer_)
+            m.read()
+            self.assertEqual(hashlib.md5(m.buffer).hexdigest(), self.md5sum)
+            self.assertEqual(m['Exif.Image.ImageDescription'].value,
+                             'Well it is a smiley that happens to be green')
+
+    def test_from_buffer_is_not_copied(self):
+        fd = open(self.filepath, 'rb')
+        data = bytearray(fd.read())
+        fd.close()
+        m = ImageMetadata.from_buffer(data)
+        # The image holds a view on the buffer, which cannot be resized
+        self.assertRaises(BufferError, data.extend, b'\x00')
+        del m
+        data.extend(b'\x00')
+
+    def test_buffer_readinto(self):
+        m = self._metadata_from_buffer()
+        self.assertEqual(m.buffer_size, os.path.getsize(self.filepath))
+        target = bytearray(m.buffer_size + 10)
+        size = m.buffer_readinto(target)
+        self.assertEqual(size, m.buffer_size)
+        self.assertEqual(hashlib.md5(target[:size]).hexdigest(), self.md5sum)
+        self.assertRaises(ValueError, m.buffer_readinto, bytearray(10))
+
+    def test_from_stream(self):
+        with open(self.filepath, 'rb') as fd:
+            data = fd.read()
+            fd.seek(0)
+            m = ImageMetadata.from_stream(fd)
+            m.read()
+            self.assertEqual(hashlib.md5(m.buffer).hexdigest(), self.md5sum)
+            self.assertEqual(m['Exif.Image.ImageDescription'].value,
+                             'Well it is a smiley that happens to be green')
+
+        class CountingStream(io.BytesIO):
+            read_size = 0
+
+            def readinto(self, buffer_):
+                size = super(CountingStream, self).readinto(buffer_)
+                self.read_size += size
+                return size
+
+        # The image starts at the current position of the stream, and only
+        # its segments holding metadata are read.
+        padding = b'\x00' * (1 << 20)
+        stream = CountingStream(b'header' + data + padding)
+        stream.seek(6)
+        m = ImageMetadata.from_stream(stream, buffer_size=1024)
+        self.assertEqual(stream.tell(), 6)
+        m.read()
+        self.assertEqual(m['Exif.Image.ImageDescription'].value,
+                         'Well it is a smiley that happens to be green')
+        self.assert_(stream.read_size < 65536)
+        self.assertEqual(m.buffer_size, len(data) + len(padding))
+        # The stream may be moved between the reads of the image.
+        stream.seek(0)
+        self.assertEqual(m.buffer, data + padding)
+
+        # The image can't be written back, but can be written elsewhere.
+        self.assertFalse(m.write())
+        m['Exif.Image.ImageDescription'] = 'A smiley'
+        self.assertRaises(RuntimeError, m.write)
+        other = ImageMetadata.from_buffer(m.write_to())
+        other.read()
+        self.assertEqual(other['Exif.Image.ImageDescription'].value,
+                         'A smiley')
+
+    def test_from_stream_errors(self):
+        # A result of the stream that can't be converted fails the read, and
+        # is reported as unraisable, as an exception raised by the stream.
+        with open(self.filepath, 'rb') as fd:
+            data = fd.read()
+
+        class BadStream(io.BytesIO):
+            def readinto(self, buffer_):
+                return 'not a size'
+
+        unraisable = []
+        hook = sys.unraisablehook
+        sys.unraisablehook = unraisable.append
+        try:
+            with self.assertRaises(Exception):
+                m = ImageMetadata.from_stream(BadStream(data))
+                m.read()
+        finally:
+            sys.unraisablehook = hook
+        self.assertTrue(unraisable)
+        self.assertTrue(issubclass(unraisable[0].exc_type, RuntimeError))
+
+    def test_from_fetch(self):
+        # A local stand-in for the ranged requests to a remote store.
+        with open(self.filepath, 'rb') as fd:
+            data = fd.read()
+        padding = b'\x00' * (1 << 20)
+        fd, path = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, data + padding)
+        os.close(fd)
+        self.addCleanup(os.remove, path)
+        requests = []
+
+        def fetch(offset, length):
+            requests.append((offset, length))
+            with open(path, 'rb') as fd:
+                fd.seek(offset)
+                return fd.read(length)
+
+        m = ImageMetadata.from_fetch(fetch, os.path.getsize(path),
+                                     block_size=4096, cache_blocks=4)
+        m.read()
+        self.assertEqual(m['Exif.Image.ImageDescription'].value,
+                         'Well it is a smiley that happens to be green')
+        # A few blocks were fetched, with the one following the first.
+        self.assert_(sum(length for offset, length in requests) < 65536)
+        self.assertEqual(requests[0], (0, 8192))
+        for offset, length in requests:
+            self.assertEqual(offset % 4096, 0)
+
+        # The blocks are cached.
+        del requests[:]
+        m.read()
+        self.assertEqual(requests, [])
+
+        self.assertEqual(m.buffer, data + padding)
+        m['Exif.Image.ImageDescription'] = 'A smiley'
+        self.assertRaises(RuntimeError, m.write)
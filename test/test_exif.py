@@ -107,31 +107,46 @@ class TestExifTag(unittest.TestCase):
         # Valid values
         tag = ExifTag('Exif.GPSInfo.GPSVersionID')
         self.assertEqual(tag.type, 'Byte')
-        self.assertEqual(tag._convert_to_python('D'), 'D')
+        self.assertEqual(tag._convert_to_python('2 2 0 0'), b'\x02\x02\x00\x00')
+        self.assertEqual(tag._convert_to_python(b'D'), b'D')
+
+        # Invalid values
+        self.failUnlessRaises(ExifValueError, tag._convert_to_python, 'D')
+        self.failUnlessRaises(ExifValueError, tag._convert_to_python, '256')
 
     def test_convert_to_string_byte(self):
         # Valid values
         tag = ExifTag('Exif.GPSInfo.GPSVersionID')
         self.assertEqual(tag.type, 'Byte')
-        self.assertEqual(tag._convert_to_string('Some text'), b'Some text')
+        self.assertEqual(tag._convert_to_string('Some'), '83 111 109 101')
+        self.assertEqual(tag._convert_to_string(b'\x02\x02'), '2 2')
+        self.assertEqual(tag._convert_to_string([2, 2, 0, 0]), '2 2 0 0')
 
         # Invalid values
         self.failUnlessRaises(ExifValueError, tag._convert_to_string, None)
+        self.failUnlessRaises(ExifValueError, tag._convert_to_string, [2, 256])
 
     def test_convert_to_python_sbyte(self):
         # Valid values
         tag = ExifTag('Exif.Pentax.Temperature')
         self.assertEqual(tag.type, 'SByte')
-        self.assertEqual(tag._convert_to_python('15'), '15')
+        self.assertEqual(tag._convert_to_python('15'), b'\x0f')
+        self.assertEqual(tag._convert_to_python('-1 15'), b'\xff\x0f')
+
+        # Invalid values
+        self.failUnlessRaises(ExifValueError, tag._convert_to_python, '128')
 
     def test_convert_to_string_sbyte(self):
         # Valid values
         tag = ExifTag('Exif.Pentax.Temperature')
         self.assertEqual(tag.type, 'SByte')
-        self.assertEqual(tag._convert_to_string('13'), b'13')
+        self.assertEqual(tag._convert_to_string(13), '13')
+        self.assertEqual(tag._convert_to_string([-5, 13]), '-5 13')
+        self.assertEqual(tag._convert_to_string(b'\xfb'), '-5')
 
         # Invalid values
         self.failUnlessRaises(ExifValueError, tag._convert_to_string, None)
+        self.failUnlessRaises(ExifValueError, tag._convert_to_string, 200)
 
     def test_convert_to_python_comment(self):
         # Valid values
@@ -303,16 +318,23 @@ class TestExifTag(unittest.TestCase):
         # Valid values
         tag = ExifTag('Exif.Photo.ExifVersion')
         self.assertEqual(tag.type, 'Undefined')
-        self.assertEqual(tag._convert_to_python('48 49 48 48'), '0100')
+        self.assertEqual(tag._convert_to_python('48 49 48 48'), b'0100')
+        self.assertEqual(tag._convert_to_python(b'0100'), b'0100')
+
+        # Invalid values
+        self.failUnlessRaises(ExifValueError, tag._convert_to_python, '0100')
 
     def test_convert_to_string_undefined(self):
         # Valid values
         tag = ExifTag('Exif.Photo.ExifVersion')
         self.assertEqual(tag.type, 'Undefined')
         self.assertEqual(tag._convert_to_string('0100'), '48 49 48 48')
+        self.assertEqual(tag._convert_to_string(b'0100'), '48 49 48 48')
+        self.assertEqual(tag._convert_to_string([48, 49, 48, 48]), '48 49 48 48')
 
         # Invalid values
-        self.failUnlessRaises(ExifValueError, tag._convert_to_string, 3)
+        self.failUnlessRaises(ExifValueError, tag._convert_to_string, None)
+        self.failUnlessRaises(ExifValueError, tag._convert_to_string, -1)
 
     def test_set_value(self):
         tag = ExifTag('Exif.Thumbnail.Orientation', 1) # top, left
@@ -320,6 +342,67 @@ class TestExifTag(unittest.TestCase):
         tag.value = 2
         self.failIfEqual(tag.value, old_value)
 
+    def test_set_value_natively(self):
+        tag = ExifTag('Exif.Image.BitsPerSample', [8, 8, 8])
+        self.assertEqual(tag.raw_value, '8 8 8')
+        self.assertEqual(tag.value, [8, 8, 8])
+        tag.value[1] = 16
+        self.assertEqual(tag.raw_value, '8 16 8')
+
+        tag = ExifTag('Exif.Image.XResolution', make_fraction(72, 1))
+        self.assertEqual(tag.raw_value, '72/1')
+        tag = ExifTag('Exif.Photo.ExposureBiasValue', make_fraction(-1, 3))
+        self.assertEqual(tag.raw_value, '-1/3')
+
+        value = datetime.datetime(2009, 3, 20, 20, 32, 0)
+        tag = ExifTag('Exif.Image.DateTime', value)
+        self.assertEqual(tag.raw_value, '2009:03:20 20:32:00')
+        tag = ExifTag('Exif.Image.DateTime', value.date())
+        self.assertEqual(tag.raw_value, '2009:03:20 00:00:00')
+        tag = ExifTag('Exif.GPSInfo.GPSDateStamp', value.date())
+        self.assertEqual(tag.raw_value, '2009:03:20')
+
+        tag = ExifTag('Exif.Photo.ExifVersion', b'0230')
+        self.assertEqual(tag.raw_value, '48 50 51 48')
+
+        tag = ExifTag('Exif.Image.Orientation')
+        self.failUnlessRaises(ExifValueError, setattr, tag, 'value', -1)
+        self.failUnlessRaises(ExifValueError, setattr, tag, 'value', '1')
+        self.failUnlessRaises(ValueError, setattr, tag, 'value', 70000)
+
+    def test_bytes_value(self):
+        tag = ExifTag('Exif.Photo.ExifVersion', '0230')
+        self.assertEqual(tag.value, b'0230')
+        tag = ExifTag('Exif.Photo.ExifVersion')
+        tag.raw_value = '48 50 51 48'
+        self.assertEqual(tag.value, b'0230')
+        tag.value = bytearray(b'0221')
+        self.assertEqual(tag.value, b'0221')
+        self.assertEqual(tag.raw_value, '48 50 50 49')
+        tag = ExifTag('Exif.GPSInfo.GPSVersionID', memoryview(b'\x02\x02\x00\x00'))
+        self.assertEqual(tag.raw_value, '2 2 0 0')
+        self.assertEqual(tag.value, b'\x02\x02\x00\x00')
+        self.failUnlessRaises(ExifValueError, setattr, tag, 'value', 256)
+        self.failUnlessRaises(ExifValueError, setattr, tag, 'value', [b'\x02', b'\x00'])
+        # A list of the values of the bytes is set as bytes too
+        tag = ExifTag('Exif.GPSInfo.GPSVersionID', [2, 3, 0, 0])
+        self.assertEqual(tag.value, b'\x02\x03\x00\x00')
+        self.assertEqual(tag.raw_value, '2 3 0 0')
+        tag.value = (2, 2)
+        self.assertEqual(tag.value, b'\x02\x02')
+
+        filepath = testutils.get_absolute_file_path(os.path.join('data', 'pentax-makernote.jpg'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        makernote = metadata['Exif.Photo.MakerNote'].value
+        self.assert_(isinstance(makernote, bytes))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        metadata.prefetch()
+        self.assertEqual(metadata['Exif.Photo.MakerNote'].value, makernote)
+        self.assertEqual(metadata['Exif.Photo.MakerNote'].raw_value,
+                         ' '.join(str(b) for b in makernote))
+
     def test_set_raw_value_invalid(self):
         tag = ExifTag('Exif.GPSInfo.GPSVersionID')
         value = '2 0 0 foo'
@@ -335,7 +418,8 @@ class TestExifTag(unittest.TestCase):
         tag2 = ExifTag('Exif.Pentax.CameraInfo')
         tag2.raw_value = '76830 20070527 2 1 4228109'
         self.assertEqual(tag2.type, 'Undefined')
-        self.failUnlessRaises(ValueError, getattr, tag2, 'value')
+        # The data of an Undefined tag is exposed as bytes
+        self.assert_(isinstance(tag2.value, bytes))
 
         filepath = testutils.get_absolute_file_path(os.path.join('data', 'pentax-makernote.jpg'))
         checksum = '646804b309a4a2d31feafe9bffc5d7f0'
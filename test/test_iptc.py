@@ -206,6 +206,28 @@ class TestIptcTag(unittest.TestCase):
         tag.value = ['Barcelona']
         self.failIfEqual(tag.value, old_value)
 
+    def test_set_value_natively(self):
+        tag = IptcTag('Iptc.Envelope.FileFormat', [2])
+        self.assertEqual(tag.raw_value, ['2'])
+        tag = IptcTag('Iptc.Application2.Keywords', ['foo', b'bar', 'déjà vu'])
+        self.assertEqual(tag.raw_value, ['foo', 'bar', 'déjà vu'])
+        tag.value = ['foo']
+        self.assertEqual(tag.raw_value, ['foo'])
+
+        tag = IptcTag('Iptc.Application2.DateCreated',
+                      [datetime.datetime(2009, 3, 20, 20, 32, 0)])
+        self.assertEqual(tag.raw_value, ['2009-03-20'])
+
+        tzinfo = FixedOffset('-', 5, 30)
+        value = datetime.time(20, 32, 0, tzinfo=tzinfo)
+        tag = IptcTag('Iptc.Application2.TimeCreated', [value])
+        self.assertEqual(tag.raw_value, ['20:32:00-05:30'])
+        self.assertEqual(tag.value, [value])
+        tag.value = [datetime.time(20, 32, 0)]
+        self.assertEqual(tag.raw_value, ['20:32:00+00:00'])
+
+        self.failUnlessRaises(IptcValueError, setattr, tag, 'value', ['foo'])
+
     def test_set_raw_value_invalid(self):
         tag = IptcTag('Iptc.Envelope.DateSent')
         value = ['foo']
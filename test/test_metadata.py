@@ -37,7 +37,7 @@ from pyexiv2.iptc import IptcTag
 from pyexiv2.xmp import XmpTag
 from pyexiv2.utils import FixedOffset, make_fraction
 
-from testutils import EMPTY_JPG_DATA
+from testutils import EMPTY_JPG_DATA, get_absolute_file_path
 
 
 
@@ -108,6 +108,203 @@ class TestImageMetadata(unittest.TestCase):
         metadata = ImageMetadata('idontexist')
         self.failUnlessRaises(IOError, metadata.read)
 
+    def test_read_many(self):
+        fd, invalid = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, b'not an image')
+        os.close(fd)
+        try:
+            paths = [self.pathname, 'idontexist', invalid, self.pathname]
+            results = ImageMetadata.read_many(paths, threads=2)
+        finally:
+            os.remove(invalid)
+        self.assertEqual(len(results), 4)
+        for metadata in (results[0], results[3]):
+            self.assert_(isinstance(metadata, ImageMetadata))
+            self.assertEqual(metadata.filename, self.pathname)
+            self.assertEqual(metadata['Exif.Image.Make'].value,
+                             'EASTMAN KODAK COMPANY')
+            self.assertEqual(metadata['Xmp.dc.format'].value, 'image/jpeg')
+        self.assert_(isinstance(results[1], IOError))
+        self.assert_(isinstance(results[2], Exception))
+        # The images read in batch can be modified and written back
+        results[0].comment = 'Read in batch'
+        results[0].write()
+
+    def test_contains_and_get(self):
+        self.metadata.read()
+        for key in ('Exif.Image.Make', 'Iptc.Application2.Caption',
+                    'Xmp.dc.format'):
+            self.assert_(key in self.metadata)
+            tag = self.metadata.get(key)
+            self.assertEqual(tag.key, key)
+            self.assert_(self.metadata.get(key) is tag)
+            self.assert_(self.metadata[key] is tag)
+        for key in ('Exif.GPSInfo.GPSLatitude', 'Iptc.Application2.City',
+                    'Xmp.dc.creator', 'Exif.NoSuchGroup.Tag', 'Xmp.nons.foo',
+                    'Foo.Bar.Baz'):
+            self.failIf(key in self.metadata)
+            self.assert_(self.metadata.get(key) is None)
+            self.assertEqual(self.metadata.get(key, 'default'), 'default')
+        # The keys are normalised if needed
+        self.assert_('Exif.Image.0x010f' in self.metadata)
+        self.assert_(self.metadata._image._tryGetExifTag('Exif.Image.0x010f')
+                     is not None)
+        # The tags are cached under their canonical key
+        tag = self.metadata.get('Exif.Image.0x010f')
+        self.assertEqual(tag.key, 'Exif.Image.Make')
+        self.assert_(self.metadata.get('Exif.Image.Make') is tag)
+        self.failIf('Exif.Image.0x010f' in self.metadata._tags['exif'])
+        # Deleted and new tags
+        del self.metadata['Exif.Image.Make']
+        self.failIf('Exif.Image.Make' in self.metadata)
+        self.metadata['Exif.Image.Model'] = 'Camera'
+        self.assert_('Exif.Image.Model' in self.metadata)
+        self.assertEqual(self.metadata.get('Exif.Image.Model').value, 'Camera')
+
+    def test_read_families(self):
+        reference = ImageMetadata(self.pathname)
+        reference.read()
+        self.assertEqual(reference.loaded_families, ('exif', 'iptc', 'xmp'))
+        for families in (('exif',), ('iptc',), ('xmp',), ('exif', 'xmp')):
+            self.metadata.read(exif='exif' in families,
+                               iptc='iptc' in families,
+                               xmp='xmp' in families)
+            self.assertEqual(self.metadata.loaded_families, families)
+            keys = [key for key in reference
+                    if key.split('.')[0].lower() in families]
+            self.assertEqual(list(self.metadata), keys)
+            for key in keys:
+                self.assertEqual(self.metadata[key].value, reference[key].value)
+            # Partially read metadata can't be written
+            self.assertRaises(RuntimeError, self.metadata.write)
+
+        self.metadata.read(iptc=False)
+        self.assertRaises(RuntimeError, getattr, self.metadata, 'iptc_keys')
+        self.assertRaises(RuntimeError, self.metadata.__getitem__,
+                          'Iptc.Application2.Caption')
+        self.metadata.read()
+        self.assertEqual(self.metadata.loaded_families, ('exif', 'iptc', 'xmp'))
+        self.assertEqual(list(self.metadata), list(reference))
+
+    def test_read_families_dimensions(self):
+        self.metadata.read(xmp=False)
+        self.assertEqual(self.metadata.dimensions, (1, 1))
+        self.metadata.read(exif=False, iptc=False)
+        self.assertEqual(self.metadata.dimensions, (1, 1))
+
+    def test_read_families_comment(self):
+        self.metadata.read(xmp=False)
+        self.assertEqual(self.metadata.comment, 'Hello World!')
+        self.metadata.read(exif=False, iptc=False)
+        self.assertEqual(self.metadata.comment, 'Hello World!')
+
+    def test_read_families_icc(self):
+        # A dummy profile, whose header holds its size, split in two chunks
+        # of APP2 segments inserted after the SOI marker
+        profile = (128).to_bytes(4, 'big') + bytes(range(124))
+        segments = b''
+        for index, chunk in enumerate((profile[:64], profile[64:])):
+            payload = b'ICC_PROFILE\x00' + bytes((index + 1, 2)) + chunk
+            segments += b'\xff\xe2' + (len(payload) + 2).to_bytes(2, 'big') \
+                + payload
+        with open(self.pathname, 'rb') as f:
+            data = f.read()
+        with open(self.pathname, 'wb') as f:
+            f.write(data[:2] + segments + data[2:])
+        self.metadata.read()
+        self.assertEqual(self.metadata.get_icc(), profile)
+        self.metadata.read(xmp=False)
+        self.assertEqual(self.metadata.get_icc(), profile)
+
+    def test_read_without_makernote(self):
+        filepath = get_absolute_file_path(os.path.join('data',
+                                                       'pentax-makernote.jpg'))
+        reference = ImageMetadata(filepath)
+        reference.read()
+        self.assert_('Exif.Pentax.Temperature' in reference.exif_keys)
+        metadata = ImageMetadata(filepath)
+        metadata.read(iptc=False, xmp=False, makernote=False)
+        for key in metadata.exif_keys:
+            self.assert_(key in reference.exif_keys)
+            self.failIf(key.startswith('Exif.Pentax.'))
+        self.assertEqual(metadata['Exif.Image.Make'].value,
+                         reference['Exif.Image.Make'].value)
+
+    def test_prefetch(self):
+        reference = ImageMetadata(self.pathname)
+        reference.read()
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        metadata.prefetch()
+        self.assertEqual(metadata.exif_keys, reference.exif_keys)
+        self.assertEqual(metadata.iptc_keys, reference.iptc_keys)
+        self.assertEqual(metadata.xmp_keys, reference.xmp_keys)
+        for key in metadata.keys():
+            tag = metadata[key]
+            ref = reference[key]
+            self.assertEqual(tag.key, ref.key)
+            self.assertEqual(tag.type, ref.type)
+            self.assertEqual(tag.raw_value, ref.raw_value)
+            self.assertEqual(tag.value, ref.value)
+        # A prefetched tag is bound to the image when modified
+        metadata['Exif.Image.Make'].value = 'Prefetched'
+        metadata.write()
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        self.assertEqual(metadata['Exif.Image.Make'].value, 'Prefetched')
+
+    def test_typed_values(self):
+        # The values read natively match those parsed from the raw values
+        # (prefetched tags are converted from their raw values).
+        def value_or_error(tag):
+            try:
+                return tag.value
+            except Exception as error:
+                return type(error)
+
+        for filename in ('DSCF_0273.JPG', 'pentax-makernote.jpg',
+                         'exiv2-bug540.jpg'):
+            filepath = get_absolute_file_path(os.path.join('data', filename))
+            native = ImageMetadata(filepath)
+            native.read()
+            parsed = ImageMetadata(filepath)
+            parsed.read()
+            parsed.prefetch()
+            for key in native.exif_keys + native.iptc_keys:
+                self.assertEqual(value_or_error(native[key]),
+                                 value_or_error(parsed[key]), key)
+
+    def test_lookups_after_changes(self):
+        # The native lookups by key stay accurate when the metadata changes
+        self.metadata.read()
+        image = self.metadata._image
+        self.assertEqual(image._getExifTag('Exif.Image.Make')._getRawValue(),
+                         'EASTMAN KODAK COMPANY')
+        image._deleteExifTag('Exif.Image.Make')
+        self.assertRaises(KeyError, image._getExifTag, 'Exif.Image.Make')
+        self.assertEqual(
+            image._getExifTag('Exif.Image.DateTime')._getRawValue(),
+            '2009:02:09 13:33:20')
+        tag = ExifTag('Exif.Image.Make', 'Canon')
+        tag._set_owner(self.metadata)
+        self.assertEqual(image._getExifTag('Exif.Image.Make')._getRawValue(),
+                         'Canon')
+        tag = IptcTag('Iptc.Application2.Keywords', ['a', 'b', 'c'])
+        tag._set_owner(self.metadata)
+        self.assertEqual(
+            image._getIptcTag('Iptc.Application2.Keywords')._getRawValues(),
+            ['a', 'b', 'c'])
+        image._deleteIptcTag('Iptc.Application2.Caption')
+        self.assertRaises(KeyError, image._getIptcTag,
+                          'Iptc.Application2.Caption')
+        self.assertEqual(
+            image._getIptcTag('Iptc.Application2.Keywords')._getRawValues(),
+            ['a', 'b', 'c'])
+        image._deleteXmpTag('Xmp.dc.format')
+        self.assertRaises(KeyError, image._getXmpTag, 'Xmp.dc.format')
+        self.assertEqual(image._getXmpTag('Xmp.dc.subject')._getArrayValue(),
+                         ['image', 'test', 'pyexiv2'])
+
     def test_write_preserve_timestamps(self):
         stat = os.stat(self.pathname)
         atime = round(stat.st_atime)
@@ -150,6 +347,284 @@ class TestImageMetadata(unittest.TestCase):
         self.failUnlessEqual(atime3, atime2)
         self.failUnlessEqual(mtime3, mtime2)
 
+    def test_write_atomic(self):
+        os.chmod(self.pathname, 0o640)
+        inode = os.stat(self.pathname).st_ino
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        metadata['Exif.Image.Make'] = 'Canon'
+        metadata.comment = 'Yellow Submarine'
+        metadata.write(atomic=True)
+
+        stat = os.stat(self.pathname)
+        if os.name != 'nt':
+            # The file was replaced, with the same permissions.
+            self.assertNotEqual(stat.st_ino, inode)
+            self.assertEqual(stat.st_mode & 0o777, 0o640)
+        directory, name = os.path.split(self.pathname)
+        self.assertEqual([entry for entry in os.listdir(directory)
+                          if entry.startswith(name + '.')], [])
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(other['Iptc.Application2.Caption'].value, ['blabla'])
+        self.assertEqual(other.comment, 'Yellow Submarine')
+
+        # The timestamps are kept to the nanosecond.
+        os.utime(self.pathname, ns=(1234567890123456789, 1234567890987654321))
+        stat = os.stat(self.pathname)
+        metadata.comment = 'Yesterday'
+        metadata.write(preserve_timestamps=True, atomic=True)
+        stat2 = os.stat(self.pathname)
+        self.assertEqual(stat2.st_mtime_ns, stat.st_mtime_ns)
+        if os.name != 'nt':
+            self.assertEqual(stat2.st_atime_ns, stat.st_atime_ns)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other.comment, 'Yesterday')
+
+    @unittest.skipIf(os.name == 'nt', 'links are not followed on Windows')
+    def test_write_atomic_links(self):
+        stat = os.stat(self.pathname)
+        symlink = self.pathname + '.symlink'
+        hardlink = self.pathname + '.hardlink'
+        os.symlink(self.pathname, symlink)
+        try:
+            # The target of a symbolic link is replaced, not the link.
+            metadata = ImageMetadata(symlink)
+            metadata.read()
+            metadata.comment = 'Yellow Submarine'
+            metadata.write(atomic=True)
+            self.assertTrue(os.path.islink(symlink))
+            self.assertEqual(os.readlink(symlink), self.pathname)
+            stat2 = os.stat(self.pathname)
+            self.assertNotEqual(stat2.st_ino, stat.st_ino)
+            self.assertEqual((stat2.st_uid, stat2.st_gid),
+                             (stat.st_uid, stat.st_gid))
+            other = ImageMetadata(self.pathname)
+            other.read()
+            self.assertEqual(other.comment, 'Yellow Submarine')
+
+            # A file with several hard links can't be replaced atomically,
+            # it is left untouched.
+            os.link(self.pathname, hardlink)
+            stat = os.stat(self.pathname)
+            metadata = ImageMetadata(self.pathname)
+            metadata.read()
+            metadata.comment = 'Yesterday'
+            self.assertRaises(IOError, metadata.write, atomic=True)
+            self.assertEqual(metadata.modified_families, ('comment',))
+            stat2 = os.stat(self.pathname)
+            self.assertEqual(stat2.st_ino, stat.st_ino)
+            self.assertEqual(stat2.st_mtime_ns, stat.st_mtime_ns)
+            self.assertEqual(os.stat(hardlink).st_ino, stat.st_ino)
+            other = ImageMetadata(hardlink)
+            other.read()
+            self.assertEqual(other.comment, 'Yellow Submarine')
+        finally:
+            os.remove(symlink)
+            if os.path.exists(hardlink):
+                os.remove(hardlink)
+        directory, name = os.path.split(self.pathname)
+        self.assertEqual([entry for entry in os.listdir(directory)
+                          if entry.startswith(name + '.')], [])
+
+    def test_write_only_modified(self):
+        os.utime(self.pathname, ns=(1234567890123456789, 1234567890987654321))
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        self.assertEqual(metadata.modified_families, ())
+        self.assertFalse(metadata.write())
+        self.assertFalse(metadata.write(atomic=True))
+        # Setting the tags to their current values doesn't modify them.
+        metadata['Exif.Image.Make'] = 'EASTMAN KODAK COMPANY'
+        metadata['Iptc.Application2.Caption'] = ['blabla']
+        metadata['Xmp.dc.format'] = 'image/jpeg'
+        metadata['Xmp.dc.subject'] = ['image', 'test', 'pyexiv2']
+        metadata.comment = 'Hello World!'
+        self.assertEqual(metadata.modified_families, ())
+        self.assertFalse(metadata.write())
+        self.assertEqual(os.stat(self.pathname).st_mtime_ns,
+                         1234567890987654321)
+
+        metadata['Iptc.Application2.Caption'] = ['blibli']
+        metadata.comment = 'Yellow Submarine'
+        self.assertEqual(metadata.modified_families, ('iptc', 'comment'))
+        self.assertTrue(metadata.write())
+        self.assertEqual(metadata.modified_families, ())
+        self.assertNotEqual(os.stat(self.pathname).st_mtime_ns,
+                            1234567890987654321)
+        del metadata['Xmp.dc.format']
+        self.assertEqual(metadata.modified_families, ('xmp',))
+        self.assertTrue(metadata.write())
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Iptc.Application2.Caption'].value, ['blibli'])
+        self.assertEqual(other.comment, 'Yellow Submarine')
+        self.assertFalse('Xmp.dc.format' in other.xmp_keys)
+
+    def test_write_patch(self):
+        filepath = get_absolute_file_path(os.path.join('data', 'DSCF_0273.JPG'))
+        with open(filepath, 'rb') as fd:
+            original = fd.read()
+        with open(self.pathname, 'wb') as fd:
+            fd.write(original)
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        self.assertRaises(ValueError, metadata.write, atomic=True, patch=True)
+
+        # Values of the same size are overwritten in place.
+        copyright = metadata['Exif.Image.Copyright'].raw_value
+        metadata['Exif.Image.Copyright'] = copyright.replace('2013', '2026')
+        metadata['Exif.Image.DateTime'] = datetime.datetime(2026, 10, 16, 8, 0)
+        self.assertTrue(metadata.write(patch=True))
+        with open(self.pathname, 'rb') as fd:
+            patched = fd.read()
+        self.assertEqual(len(patched), len(original))
+        self.assert_(sum(1 for a, b in zip(original, patched) if a != b) < 64)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Exif.Image.Copyright'].raw_value,
+                         copyright.replace('2013', '2026'))
+        self.assertEqual(other['Exif.Image.DateTime'].value,
+                         datetime.datetime(2026, 10, 16, 8, 0))
+        self.assertEqual(other['Exif.Image.Make'].value, 'FUJIFILM')
+
+        # Otherwise the whole file is rewritten.
+        metadata['Exif.Image.Make'] = 'Fujifilm Corporation'
+        metadata['Exif.Image.Copyright'] = copyright
+        self.assertTrue(metadata.write(patch=True))
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Exif.Image.Make'].value, 'Fujifilm Corporation')
+        self.assertEqual(other['Exif.Image.Copyright'].raw_value, copyright)
+        metadata.comment = 'Yellow Submarine'
+        metadata['Exif.Image.Copyright'] = copyright.replace('2013', '2026')
+        self.assertTrue(metadata.write(patch=True))
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other.comment, 'Yellow Submarine')
+        self.assertEqual(other['Exif.Image.Copyright'].raw_value,
+                         copyright.replace('2013', '2026'))
+
+    def test_xmp_sidecar(self):
+        sidecar = os.path.splitext(self.pathname)[0] + '.xmp'
+        self.addCleanup(lambda: os.path.exists(sidecar) and os.remove(sidecar))
+        with open(self.pathname, 'rb') as fd:
+            original = fd.read()
+        metadata = ImageMetadata(self.pathname, sidecar=True)
+        self.assertEqual(metadata.sidecar, sidecar)
+        metadata.read()
+        self.assertEqual(metadata['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+        metadata['Xmp.dc.subject'] = ['sidecar']
+        metadata['Xmp.dc.title'] = {'x-default': 'Sidecar'}
+        self.assertTrue(metadata.write())
+        # Only the sidecar was written.
+        with open(self.pathname, 'rb') as fd:
+            self.assertEqual(fd.read(), original)
+        self.assert_(os.path.exists(sidecar))
+
+        # The XMP metadata of the sidecar is merged with the embedded one.
+        metadata = ImageMetadata(self.pathname, sidecar=sidecar)
+        metadata.read()
+        self.assertEqual(metadata['Xmp.dc.subject'].value, ['sidecar'])
+        self.assertEqual(metadata['Xmp.dc.title'].value,
+                         {'x-default': 'Sidecar'})
+        self.assertEqual(metadata['Xmp.dc.format'].value, 'image/jpeg')
+        embedded = ImageMetadata(self.pathname)
+        embedded.read()
+        self.assertEqual(embedded['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+        self.failIf('Xmp.dc.title' in embedded.xmp_keys)
+
+        # The image is rewritten for its other metadata, keeping its XMP.
+        metadata['Exif.Image.Make'] = 'Canon'
+        metadata['Xmp.dc.subject'] = ['other']
+        self.assertTrue(metadata.write(atomic=True))
+        embedded = ImageMetadata(self.pathname)
+        embedded.read()
+        self.assertEqual(embedded['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(embedded['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+        self.failIf('Xmp.dc.title' in embedded.xmp_keys)
+        metadata = ImageMetadata(self.pathname, sidecar=True)
+        metadata.read()
+        self.assertEqual(metadata['Xmp.dc.subject'].value, ['other'])
+        self.assertEqual(metadata['Exif.Image.Make'].value, 'Canon')
+
+    def test_mapped(self):
+        filepath = get_absolute_file_path(os.path.join('data', 'DSCF_0273.JPG'))
+        with open(filepath, 'rb') as fd:
+            data = fd.read()
+        reference = ImageMetadata(filepath)
+        reference.read()
+        metadata = ImageMetadata(filepath, mapped=True)
+        metadata.read()
+        self.assertEqual(metadata.exif_keys, reference.exif_keys)
+        self.assertEqual(metadata.xmp_keys, reference.xmp_keys)
+        self.assertEqual(metadata['Exif.Image.Make'].value, 'FUJIFILM')
+        self.assertEqual([preview.data for preview in metadata.previews],
+                         [preview.data for preview in reference.previews])
+        self.assertEqual(metadata.buffer, data)
+
+        # The view on the data is not a copy, and outlives the image.
+        view = metadata.buffer_view
+        self.assert_(view.readonly)
+        self.assertEqual(view.tobytes(), data)
+        self.assertEqual(bytes(reference.buffer_view), data)
+
+        # The image can't be written back.
+        self.assertFalse(metadata.write())
+        metadata['Exif.Image.Make'] = 'Canon'
+        self.assertRaises(RuntimeError, metadata.write)
+        del metadata
+        self.assertEqual(bytes(view[:2]), b'\xff\xd8')
+        with open(filepath, 'rb') as fd:
+            self.assertEqual(fd.read(), data)
+
+    def test_write_to(self):
+        with open(self.pathname, 'rb') as fd:
+            original = fd.read()
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        metadata['Exif.Image.Make'] = 'Canon'
+        metadata['Xmp.dc.format'] = 'image/png'
+        metadata.comment = 'Yellow Submarine'
+
+        # To bytes
+        data = metadata.write_to()
+        self.assert_(isinstance(data, bytes))
+        other = ImageMetadata.from_buffer(data)
+        other.read()
+        self.assertEqual(other['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(other['Exif.Image.DateTime'].value,
+                         datetime.datetime(2009, 2, 9, 13, 33, 20))
+        self.assertEqual(other['Iptc.Application2.Caption'].value, ['blabla'])
+        self.assertEqual(other['Xmp.dc.format'].value, 'image/png')
+        self.assertEqual(other.comment, 'Yellow Submarine')
+
+        # To a new file
+        fd, pathname = tempfile.mkstemp(suffix='.jpg')
+        os.close(fd)
+        try:
+            self.assertEqual(metadata.write_to(pathname), None)
+            with open(pathname, 'rb') as fd:
+                self.assertEqual(fd.read(), data)
+        finally:
+            os.remove(pathname)
+        self.assertRaises(ValueError, metadata.write_to, '')
+
+        # Neither the image nor its file were modified.
+        with open(self.pathname, 'rb') as fd:
+            self.assertEqual(fd.read(), original)
+        self.assertEqual(metadata.buffer, original)
+        self.assertEqual(metadata['Exif.Image.Make'].value, 'Canon')
+
+        # Metadata partially read can't be written.
+        metadata.read(iptc=False)
+        self.assertRaises(RuntimeError, metadata.write_to)
+
     ###########################
     # Test EXIF-related methods
     ###########################
@@ -269,6 +744,55 @@ class TestImageMetadata(unittest.TestCase):
         self.assertEqual(len(keys), 2)
         self.assertEqual(self.metadata._keys['iptc'], keys)
 
+    def test_iptc_repeated_tag(self):
+        self.metadata.read()
+        key = 'Iptc.Application2.Keywords'
+        keywords = ['keyword%d' % i for i in range(500)]
+        self.metadata[key] = keywords
+        self.metadata.write()
+        self.metadata = ImageMetadata(self.pathname)
+        self.metadata.read()
+        keys = self.metadata._image._iptcKeys()
+        self.assertEqual(len(keys), len(set(keys)))
+        self.assertEqual(keys.count(key), 1)
+        self.assertEqual(self.metadata[key].value, keywords)
+        # Replace with fewer values, then more values
+        self.metadata[key] = keywords[:10]
+        self.assertEqual(self.metadata._image._getIptcTag(key)._getRawValues(),
+                         keywords[:10])
+        self.metadata[key] = keywords[:20]
+        self.assertEqual(self.metadata._image._getIptcTag(key)._getRawValues(),
+                         keywords[:20])
+        self.assertEqual(
+            self.metadata._image._getIptcTag(
+                'Iptc.Application2.Caption')._getRawValues(), ['blabla'])
+        del self.metadata[key]
+        self.failIf(key in self.metadata._image._iptcKeys())
+        self.assertEqual(len(self.metadata._image._iptcKeys()), 2)
+
+    def test_iptc_lookups_after_same_count(self):
+        # Values erased from a tag and added to another leave the number of
+        # datums unchanged, the lookups must not use the stale iterators.
+        self.metadata.read()
+        keywords = 'Iptc.Application2.Keywords'
+        subject = 'Iptc.Application2.Subject'
+        self.metadata[keywords] = ['a', 'b', 'c']
+        self.metadata.write()
+        self.metadata = ImageMetadata(self.pathname)
+        self.metadata.read()
+        image = self.metadata._image
+        self.assertEqual(image._getIptcTag(keywords)._getRawValues(),
+                         ['a', 'b', 'c'])
+        self.metadata[keywords] = ['a']
+        self.metadata[subject] = ['x', 'y']
+        self.assertEqual(image._getIptcTag(keywords)._getRawValues(), ['a'])
+        self.assertEqual(image._getIptcTag(subject)._getRawValues(),
+                         ['x', 'y'])
+        self.assertTrue(image._hasIptcKey(subject))
+        del self.metadata[subject]
+        self.assertFalse(image._hasIptcKey(subject))
+        self.assertEqual(image._getIptcTag(keywords)._getRawValues(), ['a'])
+
     def test_get_iptc_tag(self):
         self.metadata.read()
         self.assertEqual(self.metadata._tags['iptc'], {})
@@ -692,8 +1216,7 @@ class TestImageMetadata(unittest.TestCase):
         thumb = self.metadata.exif_thumbnail
         self.assertEqual(thumb.mime_type, '')
         self.assertEqual(thumb.extension, '')
-        # ExifThumbnail._get_data not yet implemented
-        #self.assertEqual(thumb.data, '')
+        self.assertEqual(thumb.data, b'')
         self._test_thumbnail_tags(False)
 
     def test_set_exif_thumbnail_from_data(self):
@@ -703,8 +1226,15 @@ class TestImageMetadata(unittest.TestCase):
         thumb.data = EMPTY_JPG_DATA
         self.assertEqual(thumb.mime_type, 'image/jpeg')
         self.assertEqual(thumb.extension, '.jpg')
-        # ExifThumbnail._get_data not yet implemented
-        #self.assertEqual(thumb.data, EMPTY_JPG_DATA)
+        self.assertEqual(thumb.data, EMPTY_JPG_DATA)
+        self._test_thumbnail_tags(True)
+
+    def test_set_exif_thumbnail_from_buffer(self):
+        self.metadata.read()
+        thumb = self.metadata.exif_thumbnail
+        thumb.data = memoryview(bytearray(EMPTY_JPG_DATA))
+        self.assertEqual(thumb.mime_type, 'image/jpeg')
+        self.assertEqual(thumb.data, EMPTY_JPG_DATA)
         self._test_thumbnail_tags(True)
 
     def test_set_exif_thumbnail_from_file(self):
@@ -718,8 +1248,7 @@ class TestImageMetadata(unittest.TestCase):
         os.remove(pathname)
         self.assertEqual(thumb.mime_type, 'image/jpeg')
         self.assertEqual(thumb.extension, '.jpg')
-        # ExifThumbnail._get_data not yet implemented
-        #self.assertEqual(thumb.data, EMPTY_JPG_DATA)
+        self.assertEqual(thumb.data, EMPTY_JPG_DATA)
         self._test_thumbnail_tags(True)
 
     def test_write_exif_thumbnail_to_file(self):
@@ -744,13 +1273,12 @@ class TestImageMetadata(unittest.TestCase):
         thumb.data = EMPTY_JPG_DATA
         self.assertEqual(thumb.mime_type, 'image/jpeg')
         self.assertEqual(thumb.extension, '.jpg')
-        # ExifThumbnail._get_data not yet implemented
-        #self.assertEqual(thumb.data, EMPTY_JPG_DATA)
+        self.assertEqual(thumb.data, EMPTY_JPG_DATA)
         self._test_thumbnail_tags(True)
         thumb.erase()
         self.assertEqual(thumb.mime_type, '')
         self.assertEqual(thumb.extension, '')
-        #self.assertEqual(thumb.data, '')
+        self.assertEqual(thumb.data, b'')
         self._test_thumbnail_tags(False)
 
     def test_set_exif_thumbnail_from_invalid_data(self):
@@ -785,6 +1313,20 @@ class TestImageMetadata(unittest.TestCase):
         self.assertEqual(thumb.mime_type, preview.mime_type)
         self.assertEqual(thumb.extension, preview.extension)
 
+    def test_previews_data(self):
+        filepath = get_absolute_file_path(os.path.join('data', 'DSCF_0273.JPG'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        previews = metadata.previews
+        self.failIf(len(previews) == 0)
+        for preview in previews:
+            self.assertEqual(preview.mime_type, 'image/jpeg')
+            buffer_ = preview.buffer
+            self.assert_(buffer_.readonly)
+            self.assertEqual(len(buffer_), preview.size)
+            self.assertEqual(buffer_[:2].tobytes(), b'\xff\xd8')
+            self.assertEqual(buffer_.tobytes(), preview.data)
+
     #########################
     # Test the IPTC charset #
     #########################
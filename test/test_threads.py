@@ -0,0 +1,247 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2024 fdenivac <fdenivac@gmail.com>
+#
+# This file is part of the py3exiv2 distribution.
+#
+# py3exiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# version 3 as published by the Free Software Foundation.
+#
+# py3exiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with py3exiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# ******************************************************************************
+
+import os
+import shutil
+import sys
+import sysconfig
+import tempfile
+import threading
+import time
+import unittest
+
+from pyexiv2.exif import ExifTag
+from pyexiv2.iptc import IptcTag
+from pyexiv2.metadata import ImageMetadata
+from pyexiv2.xmp import register_namespace, unregister_namespace
+
+import testutils
+
+
+NB_THREADS = 8
+NB_ROUNDS = 25
+
+
+class TestThreads(unittest.TestCase):
+
+    """
+    Stress the binding from several Python threads at once.
+    """
+
+    def setUp(self):
+        filename = os.path.join('data', 'exiv2-bug540.jpg')
+        self.filepath = testutils.get_absolute_file_path(filename)
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def _run_threads(self, *targets):
+        errors = []
+
+        def wrap(target, index):
+            try:
+                target(index)
+            except Exception as error:
+                errors.append(error)
+
+        threads = [threading.Thread(target=wrap, args=(target, i))
+                   for i in range(NB_THREADS) for target in targets]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(errors, [])
+
+    def _check_xmp(self, metadata):
+        if metadata['Xmp.dc.source'].value != 'FreeFoto.com':
+            raise AssertionError('Xmp.dc.source')
+        if metadata['Xmp.dc.subject'].value != ['Communications']:
+            raise AssertionError('Xmp.dc.subject')
+
+    def test_concurrent_xmp_reads_writes(self):
+        def read(index):
+            for i in range(NB_ROUNDS):
+                metadata = ImageMetadata(self.filepath)
+                metadata.read()
+                self._check_xmp(metadata)
+                metadata.get_xmp_packet()
+
+        def write(index):
+            path = os.path.join(self.tmpdir, 'image%d.jpg' % index)
+            shutil.copy(self.filepath, path)
+            for i in range(NB_ROUNDS):
+                metadata = ImageMetadata(path)
+                metadata.read()
+                self._check_xmp(metadata)
+                metadata['Xmp.dc.subject'] = ['Communications']
+                metadata['Xmp.dc.format'] = 'image/jpeg'
+                metadata.write()
+
+        def register(index):
+            name = 'http://py3exiv2.test/ns%d/' % index
+            for i in range(NB_ROUNDS):
+                register_namespace(name, 'ns%d' % index)
+                unregister_namespace(name)
+
+        self._run_threads(read, write, register)
+
+    def test_tag_descriptors(self):
+        # The descriptors of the tags are shared between the threads and
+        # looked up on first use.
+        descriptors = []
+
+        def describe(index):
+            for i in range(NB_ROUNDS):
+                exif = ExifTag('Exif.Photo.LensModel')
+                iptc = IptcTag('Iptc.Application2.Headline')
+                descriptors.append((exif.name, exif.label, exif.description,
+                                    iptc.name, iptc.title, iptc.description))
+
+        self._run_threads(describe)
+        self.assertEqual(len(descriptors), NB_THREADS * NB_ROUNDS)
+        self.assertEqual(len(set(descriptors)), 1)
+        self.assertEqual(descriptors[0][0], 'LensModel')
+        self.assertEqual(descriptors[0][3], 'Headline')
+
+    def test_read_many(self):
+        paths = [self.filepath] * (NB_THREADS * NB_ROUNDS)
+        results = ImageMetadata.read_many(paths, threads=NB_THREADS)
+        self.assertEqual(len(results), len(paths))
+        for metadata in results:
+            self.assertTrue(isinstance(metadata, ImageMetadata))
+            self._check_xmp(metadata)
+
+    @unittest.skipUnless(sysconfig.get_config_var('Py_GIL_DISABLED'),
+                         'requires a free-threaded build of CPython')
+    def test_gil_not_enabled(self):
+        # Importing the extension must not enable the GIL again.
+        self.assertFalse(sys._is_gil_enabled())
+
+    def test_shared_image(self):
+        # Several threads reading and writing the metadata of the same image.
+        filepath = testutils.get_absolute_file_path(
+            os.path.join('data', 'DSCF_0273.JPG'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        # The tags written are set beforehand, as adding an XMP tag moves the
+        # others in memory, and the caches of the keys are filled.
+        metadata['Xmp.dc.title'] = {'x-default': 'title'}
+        metadata['Xmp.dc.source'] = 'source'
+        metadata['Iptc.Application2.Caption'] = ['caption']
+        metadata['Exif.Image.ImageDescription'] = 'description'
+        exif_keys = list(metadata.exif_keys)
+        metadata.iptc_keys
+        metadata.xmp_keys
+        thumbnail = metadata.exif_thumbnail.data
+        previews = metadata.previews
+
+        def read(index):
+            for i in range(NB_ROUNDS):
+                for key in exif_keys:
+                    tag = metadata[key]
+                    tag.raw_value
+                    tag.human_value
+                if metadata.exif_thumbnail.data != thumbnail:
+                    raise AssertionError('thumbnail')
+                for preview in previews:
+                    preview.data
+                metadata.get_xmp_packet()
+
+        def write(index):
+            other = ImageMetadata.from_buffer(metadata.buffer)
+            other.read()
+            for i in range(NB_ROUNDS):
+                metadata['Xmp.dc.title'] = {'x-default': 'thread %d' % index}
+                metadata['Xmp.dc.source'] = 'thread %d' % index
+                metadata['Iptc.Application2.Caption'] = ['thread %d' % index]
+                metadata['Exif.Image.ImageDescription'] = 'thread %d' % index
+                metadata.copy(other)
+                other.read()
+
+        self._run_threads(read, write)
+        self.assertEqual(metadata.exif_thumbnail.data, thumbnail)
+        values = ['thread %d' % i for i in range(NB_THREADS)]
+        self.assertIn(metadata['Xmp.dc.source'].value, values)
+        self.assertIn(metadata['Iptc.Application2.Caption'].value[0], values)
+        self.assertIn(metadata['Exif.Image.ImageDescription'].value, values)
+
+    def test_gil_released(self):
+        # With an endless switch interval, the counting thread only gets to run
+        # while the main thread releases the GIL.
+        filepath = testutils.get_absolute_file_path(
+            os.path.join('data', 'DSCF_0273.JPG'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        makernote = ImageMetadata(testutils.get_absolute_file_path(
+            os.path.join('data', 'pentax-makernote.jpg')))
+        makernote.read()
+        tags = [makernote[key] for key in makernote.exif_keys
+                if key.startswith('Exif.Pentax.')]
+        xmp = ImageMetadata(self.filepath)
+        xmp.read()
+        with open(filepath, 'rb') as fd:
+            other = ImageMetadata.from_buffer(fd.read())
+        other.read()
+        thumbpath = os.path.join(self.tmpdir, 'thumbnail')
+        metadata.exif_thumbnail.write_to_file(thumbpath)
+        thumbpath += metadata.exif_thumbnail.extension
+        preview = metadata.previews[0]
+
+        calls = [
+            lambda: metadata.previews,
+            lambda: preview.write_to_file(os.path.join(self.tmpdir, 'preview')),
+            lambda: metadata.exif_thumbnail.write_to_file(
+                os.path.join(self.tmpdir, 'thumbnail')),
+            lambda: other.exif_thumbnail.set_from_file(thumbpath),
+            lambda: xmp.get_xmp_packet(),
+            lambda: metadata.get_icc(),
+            lambda: metadata.copy(other),
+            lambda: [tag.human_value for tag in tags],
+        ]
+
+        counter = [0]
+        stop = threading.Event()
+
+        def count():
+            while not stop.is_set():
+                counter[0] += 1
+                time.sleep(0.00001)
+
+        interval = sys.getswitchinterval()
+        sys.setswitchinterval(1000)
+        thread = threading.Thread(target=count)
+        thread.start()
+        try:
+            for call in calls:
+                before = counter[0]
+                for i in range(10000):
+                    call()
+                    if counter[0] != before:
+                        break
+                self.assertNotEqual(counter[0], before)
+        finally:
+            stop.set()
+            sys.setswitchinterval(interval)
+            thread.join()
+
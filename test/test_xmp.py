@@ -382,6 +382,15 @@ class TestXmpTag(unittest.TestCase):
         tag.value = 'bleh'
         self.assertEqual(tag.value, 'bleh')
 
+    def test_descriptors_of_array_items(self):
+        # The descriptors of the fields of array items don't depend on the
+        # index of the item.
+        tags = [XmpTag('Xmp.xmpMM.History[%d]/stEvt:when' % index)
+                for index in (1, 2, 37)]
+        self.assertEqual(set((tag.name, tag.type) for tag in tags),
+                         set([(tags[0].name, tags[0].type)]))
+        self.assertEqual(tags[0].name, 'when')
+
 
 class TestXmpNamespaces(unittest.TestCase):
 